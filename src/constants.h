@@ -9,20 +9,78 @@
 static constexpr uint32_t kLength = 65;
 static constexpr uint32_t kPeriod = 12;
 static constexpr uint32_t kHardPushLimit = 12;
+// Extenders with a shorter period have no virtual push limit, see
+// snaperz_extender.h, and are not simulated.
+static constexpr uint32_t kMinValidPeriod = 8;
 
-// Constants
-static constexpr uint32_t kVirtualPushLimit = (kPeriod / 4 - 2);
-static constexpr uint32_t kPushLimit = std::min(kHardPushLimit, kVirtualPushLimit);
-static constexpr uint32_t kLastPushLimit = std::min(kPushLimit + 1, kHardPushLimit);
+// Range of extenders that are compiled into the program, in addition to the
+// one above. Any of them can be selected on the command line, e.g. through
+// "extender 40 16". Every extender is compiled separately, so large ranges
+// take a long time to compile.
+static constexpr uint32_t kMinLength = kLength;
+static constexpr uint32_t kMaxLength = kLength;
+static constexpr uint32_t kMinPeriod = kPeriod;
+static constexpr uint32_t kMaxPeriod = kPeriod;
 
-typedef smallest_fit<kLength + 1>::type len_t;
+// Constants of an extender with length L and period P. The implementations
+// are templates over this type, which allows a single program to simulate
+// several different extenders.
+template<uint32_t L, uint32_t P>
+struct Config
+{
+  static_assert(P >= kMinValidPeriod, "The period must be at least 8 ticks");
+
+  static constexpr uint32_t kLength = L;
+  static constexpr uint32_t kPeriod = P;
+  static constexpr uint32_t kVirtualPushLimit = (kPeriod / 4 - 2);
+  static constexpr uint32_t kPushLimit = std::min(kHardPushLimit, kVirtualPushLimit);
+  static constexpr uint32_t kLastPushLimit = std::min(kPushLimit + 1, kHardPushLimit);
+
+  typedef typename smallest_fit<kLength + 1>::type len_t;
+};
+
+typedef Config<kLength, kPeriod> DefaultConfig;
+
+// Number of windows that the AVX2 implementation keeps in registers. Must be
+// an even number, and at least 2. More windows keep more pulses in flight,
+// which helps long extenders, at the cost of more register pressure.
+static constexpr uint32_t kAvx2WindowCount = 4;
 
 // Definitions for checking loops. Use 1 for on, 0 for off.
 #define CHECK_LOOP 1
-// Can be up to 2 times faster at finding loops, but slows down simulation slightly.
+// Sweeps check for loops with a second extender at half speed, see
+// snaperz_sweep.h. Can be up to 2 times faster at finding loops, but slows
+// down simulation slightly.
 #define FAST_LOOP_DETECTION 1
+// Checks for loops of a single extender on a second thread, see
+// snaperz_loop_thread.h, which keeps the simulating thread free of anything
+// but the simulation. Either way, the extender is only sampled every
+// LOOP_CHECK_INTERVAL pulses, see snaperz_loop.h, which must divide
+// LOGGING_INTERVAL, so both find the same loops.
+//
+// A sample only copies a few words, see take_sample(). Measured in between
+// pulses at -O2, sampling after every pulse costs 2 to 7 ns per pulse on top
+// of the 13 to 110 ns per pulse of the AVX2 and AVX-512 engines, while every
+// 16 pulses it costs up to 1.5 ns per pulse, and every 64 pulses it is lost
+// in the noise. Sampling more often only notices loops a few pulses sooner.
+// The interval must also be a multiple of 64, since the windows of the
+// windowed engines return to the same phase every 64 pulses at most, which
+// keeps the phase of the samples the same, see snaperz_fingerprint.h.
+#define LOOP_CHECK_THREAD 1
+#define LOOP_CHECK_INTERVAL UINT64_C(64)
+// Loops of a single extender are found by remembering distinguished states,
+// see snaperz_loop_table.h, in a table of LOOP_TABLE_SIZE entries of 16 bytes
+// each. Finds loops far sooner than Brent's algorithm for extenders that take
+// long to enter their loop. Use 0 for Brent's algorithm instead.
+#define DISTINGUISHED_POINTS 1
+#define LOOP_TABLE_SIZE (UINT64_C(1) << 20)
 
 // Definitions for logging status updates
 #define LOG_STATUS_UPDATES 1
 // Interval in number of pulses
 #define LOGGING_INTERVAL UINT64_C(100000000)
+
+// Definitions for extenders that are not compiled into the program. Use 1 to
+// compile a kernel for them when they are selected on the command line, see
+// snaperz_kernel.h, or 0 to reject them.
+#define COMPILE_KERNELS 1
@@ -3,8 +3,17 @@
 #include <cstdint>
 #include <iomanip>
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
 
 #include "snaperz_extender.h"
+#include "snaperz_loop.h"
+#include "snaperz_loop_thread.h"
+#include "snaperz_sweep.h"
+#include "snaperz_sweep_dir.h"
+#include "snaperz_kernel.h"
+#include "snaperz_topology.h"
 #include "constants.h"
 
 std::ostream& print_time(std::ostream& os, std::chrono::nanoseconds ns)
@@ -27,91 +36,321 @@ std::ostream& print_time(std::ostream& os, std::chrono::nanoseconds ns)
     return os;
 }
 
-void simulate_extender()
+#if LOG_STATUS_UPDATES
+void print_status(uint64_t pulses, std::chrono::steady_clock::time_point start_time)
+{
+  std::cout
+    << pulses
+    << " pulses so far... (";
+  auto delta = std::chrono::steady_clock::now() - start_time;
+  print_time(std::cout, delta);
+  std::cout
+    << ")\r"
+    << std::flush;
+}
+#endif // LOG_STATUS_UPDATES
+
+void print_loop(const snaperz::Loop& loop)
+{
+  std::cout
+    << "Loop at "
+    << loop.pulses
+    << " pulses, with a length of "
+    << loop.length
+    << " pulses, starting after "
+    << loop.start
+    << " pulses."
+    // Note: print spaces instead of status message
+    << std::setfill(' ') << std::setw(20) << ' '
+    << std::endl;
+}
+
+// How loops are checked, see snaperz_loop.h.
+static constexpr snaperz::LoopCheck kLoopCheck = !CHECK_LOOP ? snaperz::LoopCheck::kNone
+  : DISTINGUISHED_POINTS ? snaperz::LoopCheck::kDistinguishedPoints
+  : snaperz::LoopCheck::kBrent;
+
+// Simulates the given extender until it finishes or loops, while a second
+// thread checks for loops and logs status updates, see
+// snaperz_loop_thread.h. Returns true if it loops.
+template<typename C>
+bool simulate_on_two_threads(snaperz::Extender<C>& extender, uint64_t& pulses,
+                             std::chrono::steady_clock::time_point start_time)
+{
+  std::function<void(uint64_t)> on_status;
+#if LOG_STATUS_UPDATES
+  on_status = [&](uint64_t sample_pulses)
+  {
+    if (sample_pulses % LOGGING_INTERVAL == 0 && sample_pulses != 0)
+    {
+      print_status(sample_pulses, start_time);
+    }
+  };
+#endif // LOG_STATUS_UPDATES
+  snaperz::Loop loop;
+  if (snaperz::simulate_with_loop_thread(extender, pulses, kLoopCheck, on_status, loop))
+  {
+    print_loop(loop);
+    return true;
+  }
+  return false;
+}
+
+// Simulates the given extender until it finishes or loops, and checks for
+// loops and logs status updates in between pulses, see snaperz_loop.h.
+// Returns true if it loops.
+template<typename C>
+bool simulate_on_one_thread(snaperz::Extender<C>& extender, uint64_t& pulses,
+                            std::chrono::steady_clock::time_point start_time)
+{
+  std::function<void(uint64_t)> on_status;
+#if LOG_STATUS_UPDATES
+  on_status = [&](uint64_t status_pulses)
+  {
+    print_status(status_pulses, start_time);
+  };
+#endif // LOG_STATUS_UPDATES
+  snaperz::Loop loop;
+  if (snaperz::simulate_with_loop_check(extender, pulses, kLoopCheck, on_status, loop))
+  {
+    print_loop(loop);
+    return true;
+  }
+  return false;
+}
+
+template<typename C>
+void simulate_extender(snaperz::Backend backend)
 {
   auto start_time = std::chrono::steady_clock::now();
   
   std::cout
     << "Running "
-    << kLength << " extender, "
-    << kPeriod << " tick period."
+    << C::kLength << " extender, "
+    << C::kPeriod << " tick period ("
+    << snaperz::backend_name(backend) << ")."
     << std::endl;
 
-  snaperz::Extender extender = snaperz::create();
+  snaperz::Extender<C> extender = snaperz::create<C>(backend);
   uint64_t pulses = 0;
 
-#if LOG_STATUS_UPDATES
-  uint64_t pulses_since_last_status_update = 0;
-#endif // LOG_STATUS_UPDATES
+  // Loops are only checked on a second thread if there is a CPU for it.
+  const bool loop_thread = CHECK_LOOP && LOOP_CHECK_THREAD && snaperz::loop_thread_cpu() >= 0;
+  const bool looped = loop_thread
+    ? simulate_on_two_threads<C>(extender, pulses, start_time)
+    : simulate_on_one_thread<C>(extender, pulses, start_time);
+  if (!looped)
+  {
+    // Print final status message.
+    std::cout
+      << "Done! "
+      << pulses
+      << " pulses in total (";
+    auto delta = std::chrono::steady_clock::now() - start_time;
+    print_time(std::cout, delta);
+    std::cout << ")" << std::endl;
+  }
 
-#if CHECK_LOOP
-  snaperz::Extender slow_extender = snaperz::create();
-#endif // CHECK_LOOP
+  // Perform Cleanup
+  snaperz::destroy(extender);
+}
 
-  while (!snaperz::finished(extender))
+// Parses a range of the form "first-last", or a single value.
+bool parse_range(const char* text, uint32_t& first, uint32_t& last)
+{
+  char* end;
+  first = static_cast<uint32_t>(std::strtoul(text, &end, 10));
+  last = first;
+  if (*end == '-')
   {
-    snaperz::simulate_pulse(extender);
-    pulses++;
+    last = static_cast<uint32_t>(std::strtoul(end + 1, &end, 10));
+  }
+  return end != text && *end == '\0' && first <= last;
+}
 
-#if LOG_STATUS_UPDATES
-    pulses_since_last_status_update++;
-    if (pulses_since_last_status_update == LOGGING_INTERVAL)
+// Parses a range of periods, see parse_range(), every one of which must be
+// long enough to have a virtual push limit, see constants.h.
+bool parse_periods(const char* text, uint32_t& first, uint32_t& last)
+{
+  return parse_range(text, first, last) && first >= kMinValidPeriod;
+}
+
+void print_sweep_result(const snaperz::SweepResult& result)
+{
+  std::cout
+    << result.job.length << " extender, "
+    << result.job.period << " tick period: "
+    << (result.loop ? "Loop at " : "Done! ")
+    << result.pulses
+    << " pulses."
+    << std::endl;
+}
+
+// Sweeps the given extenders on this machine, or hands them to the workers
+// of the given directory if there is one. Returns the exit status of the
+// program.
+int sweep_extenders(uint32_t first_length, uint32_t last_length,
+                    uint32_t first_period, uint32_t last_period,
+                    const char* dir = nullptr)
+{
+  auto start_time = std::chrono::steady_clock::now();
+
+  std::vector<snaperz::SweepJob> jobs;
+  for (uint32_t length = first_length; length <= last_length; length++)
+  {
+    for (uint32_t period = first_period; period <= last_period; period++)
     {
-      pulses_since_last_status_update = 0;
-      std::cout
-        << pulses
-        << " pulses so far... (";
-      auto delta = std::chrono::steady_clock::now() - start_time;
-      print_time(std::cout, delta);
-      std::cout
-        << ")\r"
-        << std::flush;
+      jobs.push_back({ length, period });
     }
-#endif // LOG_STATUS_UPDATES
+  }
+  std::cout
+    << "Sweeping "
+    << first_length << "-" << last_length << " extenders, "
+    << first_period << "-" << last_period << " tick periods ("
+    << jobs.size() << " jobs)."
+    << std::endl;
 
-#if CHECK_LOOP
-    // Skip every other pulse for the slower segments.
-    if ((pulses & 0x1) == 0)
+  if (dir == nullptr)
+  {
+    snaperz::sweep(jobs, print_sweep_result);
+  }
+  else if (!snaperz::sweep_dir::coordinate(dir, jobs, print_sweep_result))
+  {
+    return 1;
+  }
+
+  std::cout << "Sweep done! (";
+  auto delta = std::chrono::steady_clock::now() - start_time;
+  print_time(std::cout, delta);
+  std::cout << ")" << std::endl;
+  return 0;
+}
+
+// Simulates the jobs of the sweep in the given directory, and returns the
+// exit status of the program.
+int work_on_sweep(const char* dir)
+{
+  auto start_time = std::chrono::steady_clock::now();
+
+  std::cout << "Working on the sweep in " << dir << "." << std::endl;
+  if (!snaperz::sweep_dir::work(dir, print_sweep_result))
+  {
+    return 1;
+  }
+
+  std::cout << "Sweep done! (";
+  auto delta = std::chrono::steady_clock::now() - start_time;
+  print_time(std::cout, delta);
+  std::cout << ")" << std::endl;
+  return 0;
+}
+
+// Simulates the extender C, with the fastest backend supported by the CPU,
+// and returns the exit status of the program.
+template<typename C>
+int run_extender()
+{
+  snaperz::Backend backend = snaperz::detect_backend<C>();
+  // Allow overriding the backend, e.g. for comparing them on a single host.
+  if (const char* name = std::getenv("SNAPERZ_BACKEND"))
+  {
+    if (!snaperz::parse_backend(name, backend) || !snaperz::supported<C>(backend))
     {
-      snaperz::simulate_pulse(slow_extender);
+      std::cerr << "Backend '" << name << "' is not supported." << std::endl;
+      return 1;
     }
-#if FAST_LOOP_DETECTION
-    if (snaperz::equals(extender, slow_extender)) // loop check
+  }
+  // Keep the simulation on the NUMA node of its memory, see
+  // snaperz_topology.h.
+  snaperz::pin_thread();
+  simulate_extender<C>(backend);
+  return 0;
+}
+
+#if SNAPERZ_KERNEL_LENGTH
+// The entry point of a kernel, which is this file compiled for a single
+// extender, see snaperz_kernel.h.
+extern "C" __attribute__((visibility("default"))) int snaperz_kernel_main()
+{
+  return run_extender<Config<SNAPERZ_KERNEL_LENGTH, SNAPERZ_KERNEL_PERIOD>>();
+}
+#else // SNAPERZ_KERNEL_LENGTH
+int main(int argc, char** argv)
+{
+  // Simulate a range of extenders instead of the configured one, e.g.
+  // "extender sweep 20-40 12-19".
+  if (argc > 1 && std::strcmp(argv[1], "sweep") == 0)
+  {
+    uint32_t first_length, last_length, first_period, last_period;
+    if (argc != 4 || !parse_range(argv[2], first_length, last_length) ||
+        !parse_periods(argv[3], first_period, last_period) || first_length == 0)
     {
-#else // FAST_LOOP_DETECTION
-    // Slow loop detection: skip every other check.
-    if ((pulses & 0x1) == 0 && snaperz::equals(extender, slow_extender)) // loop check
+      std::cerr << "Usage: " << argv[0] << " sweep <lengths> <periods>" << std::endl;
+      return 1;
+    }
+    return sweep_extenders(first_length, last_length, first_period, last_period);
+  }
+  // Share a sweep with other processes through a directory, e.g.
+  // "extender coordinate /shared/sweep 20-40 12-19" on one machine, and
+  // "extender work /shared/sweep" on every machine.
+  if (argc > 1 && std::strcmp(argv[1], "coordinate") == 0)
+  {
+    uint32_t first_length, last_length, first_period, last_period;
+    if (argc != 5 || !parse_range(argv[3], first_length, last_length) ||
+        !parse_periods(argv[4], first_period, last_period) || first_length == 0)
     {
-#endif // !FAST_LOOP_DETECTION
-      std::cout
-        << "Loop at "
-        << pulses
-        << " pulses."
-        // Note: print spaces instead of status message
-        << std::setfill(' ') << std::setw(20) << ' '
-        << std::endl;
-      return;
+      std::cerr << "Usage: " << argv[0] << " coordinate <dir> <lengths> <periods>" << std::endl;
+      return 1;
     }
-#endif // CHECK_LOOP
+    return sweep_extenders(first_length, last_length, first_period, last_period, argv[2]);
+  }
+  if (argc > 1 && std::strcmp(argv[1], "work") == 0)
+  {
+    if (argc != 3)
+    {
+      std::cerr << "Usage: " << argv[0] << " work <dir>" << std::endl;
+      return 1;
+    }
+    return work_on_sweep(argv[2]);
   }
-  // Print final status message.
-  std::cout
-    << "Done! "
-    << pulses
-    << " pulses in total (";
-    auto delta = std::chrono::steady_clock::now() - start_time;
-    print_time(std::cout, delta);
-    std::cout << ")" << std::endl;
 
-  // Perform Cleanup
-  snaperz::destroy(extender);
-#if CHECK_LOOP
-  snaperz::destroy(slow_extender);
-#endif // CHECK_LOOP
-}
+  // Simulate the configured extender, or one of the other extenders that are
+  // compiled into the program, e.g. "extender 40 16".
+  uint32_t length = kLength;
+  uint32_t period = kPeriod;
+  if (argc > 1)
+  {
+    char* length_end;
+    char* period_end;
+    length = static_cast<uint32_t>(std::strtoul(argv[1], &length_end, 10));
+    period = argc > 2 ? static_cast<uint32_t>(std::strtoul(argv[2], &period_end, 10)) : 0;
+    if (argc != 3 || *length_end != '\0' || *period_end != '\0' || period < kMinValidPeriod)
+    {
+      std::cerr << "Usage: " << argv[0] << " [<length> <period>]" << std::endl;
+      std::cerr << "       " << argv[0] << " sweep <lengths> <periods>" << std::endl;
+      std::cerr << "       " << argv[0] << " coordinate <dir> <lengths> <periods>" << std::endl;
+      std::cerr << "       " << argv[0] << " work <dir>" << std::endl;
+      return 1;
+    }
+  }
 
-int main()
-{
-  simulate_extender();
-  return 0;
+  int status = 0;
+  if (snaperz::visit_config(length, period, [&](auto config)
+      {
+        status = run_extender<decltype(config)>();
+      }))
+  {
+    return status;
+  }
+#if COMPILE_KERNELS
+  if (snaperz::kernel::run(length, period, status))
+  {
+    return status;
+  }
+#endif // COMPILE_KERNELS
+  std::cerr
+    << "The " << length << " extender with a " << period << " tick period is not "
+    << "compiled into the program, see src/constants.h." << std::endl;
+  return 1;
 }
+#endif // !SNAPERZ_KERNEL_LENGTH
@@ -0,0 +1,24 @@
+#pragma once
+
+// Files that are expensive to recreate, such as compiled kernels, are cached
+// on disk between runs. They are stored in $SNAPERZ_CACHE_DIR,
+// $XDG_CACHE_HOME/snaperz or ~/.cache/snaperz, whichever is set first.
+#include <cstdlib>
+#include <filesystem>
+
+namespace snaperz
+{
+  inline std::filesystem::path cache_dir()
+  {
+    if (const char* dir = std::getenv("SNAPERZ_CACHE_DIR"))
+    {
+      return dir;
+    }
+    if (const char* dir = std::getenv("XDG_CACHE_HOME"))
+    {
+      return std::filesystem::path(dir) / "snaperz";
+    }
+    const char* home = std::getenv("HOME");
+    return std::filesystem::path(home ? home : ".") / ".cache" / "snaperz";
+  }
+} // namespace snaperz
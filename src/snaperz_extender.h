@@ -3,6 +3,7 @@
 #include <algorithm>
 
 #include "constants.h"
+#include "snaperz_fingerprint.h"
 
 // To learn more about Snaperz extenders, take a look at this document:
 // https://docs.google.com/document/d/1KCM7lk-GBn_-RIhuuUiZdNNiBWDc6Zm7g88cdIFOeQg/edit
@@ -71,41 +72,425 @@
 
 namespace snaperz
 {
+  // The engines that are able to simulate an extender. Every engine is
+  // compiled into the program, and the fastest one that is supported by the
+  // CPU is picked at runtime, see detect_backend().
+  enum class Backend
+  {
+    // Portable implementation that runs on every CPU.
+    kFallback,
+    // Implementation using 128-bit registers, see snaperz_extender_sse41.h.
+    kSse41,
+    // Implementation using 256-bit registers, see snaperz_extender_avx2.h.
+    kAvx2,
+    // Implementation using 512-bit registers, see snaperz_extender_avx512.h.
+    kAvx512,
+    // Implementation evaluating every pulse as a parallel prefix over the
+    // carries between segments, see snaperz_extender_lookahead.h.
+    kLookahead,
+    // Portable implementation packing the segments into 64-bit integers, see
+    // snaperz_extender_swar.h.
+    kSwar,
+  };
+
+  // An extender with the constants of C, which is an instance of Config.
+  template<typename C>
   struct Extender;
 
+  // Checks whether the given backend can simulate the extender C on the CPU
+  // that is currently running the program.
+  template<typename C>
+  bool supported(Backend backend);
+
+  // Returns the fastest backend that is supported by the CPU and that is able
+  // to simulate the extender C.
+  template<typename C>
+  Backend detect_backend();
+
+  // Returns the name of the given backend, e.g. for printing purposes.
+  const char* backend_name(Backend backend);
+
+  // Finds the backend with the given name. Returns false if there is none.
+  bool parse_backend(const char* name, Backend& backend);
+
   // Initializes the given extender to the extended state, i.e. one where every
   // segment has length one (indicating that every piston is in its own segment
-  // with one air block in between).
+  // with one air block in between). The extender is simulated by the given
+  // backend, which must be supported.
   //
   // Note: the extender returned by this method must be destroyed using the
   //       complementary destroy_snaperz_extender(...) function.
-  Extender create();
+  template<typename C>
+  Extender<C> create(Backend backend = detect_backend<C>());
 
   // Frees up memory used by a snaperz extender created after an invocation of
   // the create_snaperz_extender() function.
   //
   // Note: the extender is no longer usable after an invocation of this method.
-  void destroy(Extender& extender);
+  template<typename C>
+  void destroy(Extender<C>& extender);
+
+  // Copies the state of an extender into another one, which must be simulated
+  // by the same backend. The copy continues exactly like the original, which
+  // allows taking snapshots of an extender, and restoring them later.
+  template<typename C>
+  void copy(Extender<C>& dst, const Extender<C>& src);
 
   // Simulate a single extender pulse. Note that while in-game multiple pulses
   // occur simultaneously, this function captures that context in the virtual
   // push limit, which is dependent on the period of the extender.
-  void simulate_pulse(Extender& extender);
+  template<typename C>
+  void simulate_pulse(Extender<C>& extender);
+
+  // Checks if two extenders are in the same state. Both extenders must be
+  // simulated by the same backend. The engines that keep several pulses in
+  // flight also compare the phase of their windows, so extenders with the
+  // same segments, see read_segments(), may still differ.
+  template<typename C>
+  bool equals(const Extender<C>& lhs, const Extender<C>& rhs);
+
+  // Returns a hash of the state that equals() compares, such that equal
+  // extenders have equal fingerprints, see snaperz_fingerprint.h. Like
+  // equals(), fingerprints are only comparable for the same backend.
+  template<typename C>
+  uint64_t fingerprint(const Extender<C>& extender);
+
+  // Copies the state that the fingerprint of the extender is computed from
+  // into the given sample, so that sample_fingerprint() of the sample is the
+  // fingerprint of the extender, see snaperz_fingerprint.h. Unlike
+  // fingerprint(), this only copies a few words.
+  template<typename C>
+  void take_sample(const Extender<C>& extender, Sample& sample);
 
-  // Checks if two extenders contain the same segments
-  bool equals(const Extender& lhs, const Extender& rhs);
+  // Writes the lengths of the kLength + 1 segments of the extender to the
+  // given array, as they are after every pulse simulated so far. Engines
+  // that keep several pulses in flight complete them first, so unlike the
+  // state that equals() compares, the segments are the same for every
+  // backend after the same number of pulses.
+  template<typename C>
+  void read_segments(const Extender<C>& extender, typename C::len_t* segments);
 
   // Checks whether the given extender is finished, i.e. whether the extender
   // reached the goal state, where every block is retracted into a single
   // segment.
-  bool finished(const Extender& extender);
+  template<typename C>
+  bool finished(const Extender<C>& extender);
+
+  // Invokes the given function with a default constructed Config of the
+  // extender with the given length and period. Only the extenders in the
+  // range of constants.h are compiled into the program, and the function is
+  // not invoked for any other extender, in which case false is returned.
+  template<typename F>
+  bool visit_config(uint32_t length, uint32_t period, F&& f);
 }
 
-// Specialized implementations of the snaperz extender.
-#if __AVX2__
-// Use the faster AVX2 implementation
-#include "snaperz_extender_avx2.h"
-#else // __AVX2__
-#warning "AVX2 not supported. Using fallback implementation."
+#if defined(__x86_64__) || defined(__i386__)
+#define SNAPERZ_X86 1
+#else // x86
+#define SNAPERZ_X86 0
+#endif // !x86
+
+// Specialized implementations of the snaperz extender. Each of them lives in
+// its own namespace, and is compiled for its own instruction set.
 #include "snaperz_extender_fallback.h"
-#endif // !__AVX2__
+#include "snaperz_extender_swar.h"
+#if SNAPERZ_X86
+#include "snaperz_extender_sse41.h"
+#include "snaperz_extender_avx2.h"
+#include "snaperz_extender_avx512.h"
+#include "snaperz_extender_lookahead.h"
+#endif // SNAPERZ_X86
+
+#include <cassert>
+#include <cstring>
+#include <utility>
+
+namespace snaperz
+{
+  template<typename C>
+  struct Extender
+  {
+    // The backend that simulates this extender.
+    Backend backend;
+    // The state of the extender, which is only valid for the backend above.
+    union
+    {
+      fallback::Extender<C> fallback;
+      swar::Extender<C> swar;
+#if SNAPERZ_X86
+      avx2::Extender<C> avx2;
+      avx512::Extender<C> avx512;
+      sse41::Extender<C> sse41;
+      lookahead::Extender<C> lookahead;
+#endif // SNAPERZ_X86
+    };
+  };
+
+  // Invokes the given function with the engine specific state of the given
+  // extenders, which must all use the same backend. Engines that do not
+  // support the extender are never instantiated, since their kernels are not
+  // defined for it.
+  template<typename C, typename F, typename E, typename... Es>
+  inline auto _visit(F&& f, E& extender, Es&... extenders)
+  {
+    assert(((extenders.backend == extender.backend) && ...));
+    switch (extender.backend)
+    {
+#if SNAPERZ_X86
+    case Backend::kAvx512:
+      if constexpr (avx512::kSupported<C>)
+      {
+        return f(extender.avx512, extenders.avx512...);
+      }
+      break;
+    case Backend::kAvx2:
+      if constexpr (avx2::kSupported<C>)
+      {
+        return f(extender.avx2, extenders.avx2...);
+      }
+      break;
+    case Backend::kSse41:
+      if constexpr (sse41::kSupported<C>)
+      {
+        return f(extender.sse41, extenders.sse41...);
+      }
+      break;
+    case Backend::kLookahead:
+      if constexpr (lookahead::kSupported<C>)
+      {
+        return f(extender.lookahead, extenders.lookahead...);
+      }
+      break;
+#endif // SNAPERZ_X86
+    case Backend::kSwar:
+      if constexpr (swar::kSupported<C>)
+      {
+        return f(extender.swar, extenders.swar...);
+      }
+      break;
+    case Backend::kFallback:
+      break;
+    }
+    return f(extender.fallback, extenders.fallback...);
+  }
+
+  template<typename C>
+  bool supported(Backend backend)
+  {
+    switch (backend)
+    {
+#if SNAPERZ_X86
+    case Backend::kAvx512:
+      return avx512::kSupported<C> && __builtin_cpu_supports("avx512f") &&
+             __builtin_cpu_supports("avx512bw");
+    case Backend::kAvx2:
+      return avx2::kSupported<C> && __builtin_cpu_supports("avx2");
+    case Backend::kSse41:
+      return sse41::kSupported<C> && __builtin_cpu_supports("sse4.1");
+    case Backend::kLookahead:
+      return lookahead::kSupported<C> && __builtin_cpu_supports("avx2");
+#endif // SNAPERZ_X86
+    case Backend::kSwar:
+      return swar::kSupported<C>;
+    case Backend::kFallback:
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  template<typename C>
+  Backend detect_backend()
+  {
+#if SNAPERZ_X86
+    // Extenders that fit in the AVX2 windows never leave the registers, see
+    // _simulate_resident_pulse, which beats the wider AVX-512 registers,
+    // e.g. 14 rather than 21 ns per pulse for 30 and 50 long extenders.
+    if constexpr (avx2::kSupported<C> && avx2::kResident<C>)
+    {
+      if (supported<C>(Backend::kAvx2))
+      {
+        return Backend::kAvx2;
+      }
+    }
+#endif // SNAPERZ_X86
+    // Otherwise, ordered from fastest to slowest.
+    static constexpr Backend kBackends[] = {
+      Backend::kAvx512,
+      Backend::kAvx2,
+      Backend::kSse41,
+      Backend::kSwar,
+    };
+    for (Backend backend : kBackends)
+    {
+      if (supported<C>(backend))
+      {
+        return backend;
+      }
+    }
+    return Backend::kFallback;
+  }
+
+  inline const char* backend_name(Backend backend)
+  {
+    switch (backend)
+    {
+    case Backend::kFallback:
+      return "fallback";
+    case Backend::kSse41:
+      return "sse41";
+    case Backend::kAvx2:
+      return "avx2";
+    case Backend::kAvx512:
+      return "avx512";
+    case Backend::kLookahead:
+      return "lookahead";
+    case Backend::kSwar:
+      return "swar";
+    }
+    return "unknown";
+  }
+
+  inline bool parse_backend(const char* name, Backend& backend)
+  {
+    static constexpr Backend kBackends[] = {
+      Backend::kFallback,
+      Backend::kSse41,
+      Backend::kAvx2,
+      Backend::kAvx512,
+      Backend::kLookahead,
+      Backend::kSwar,
+    };
+    for (Backend candidate : kBackends)
+    {
+      if (std::strcmp(name, backend_name(candidate)) == 0)
+      {
+        backend = candidate;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  template<typename C>
+  Extender<C> create(Backend backend)
+  {
+    assert(supported<C>(backend));
+    Extender<C> extender;
+    extender.backend = backend;
+    switch (backend)
+    {
+#if SNAPERZ_X86
+    // Note: the engines using wider registers are created in a variable
+    //       first, since the compiler does not align temporaries of types
+    //       with an explicit alignment in code compiled for other
+    //       instruction sets.
+    case Backend::kAvx512:
+    {
+      const avx512::Extender<C> state = avx512::create<C>();
+      extender.avx512 = state;
+      break;
+    }
+    case Backend::kAvx2:
+    {
+      const avx2::Extender<C> state = avx2::create<C>();
+      extender.avx2 = state;
+      break;
+    }
+    case Backend::kSse41:
+      extender.sse41 = sse41::create<C>();
+      break;
+    case Backend::kLookahead:
+      extender.lookahead = lookahead::create<C>();
+      break;
+#endif // SNAPERZ_X86
+    case Backend::kSwar:
+      extender.swar = swar::create<C>();
+      break;
+    default:
+      extender.fallback = fallback::create<C>();
+      break;
+    }
+    return extender;
+  }
+
+  template<typename C>
+  void destroy(Extender<C>& extender)
+  {
+    _visit<C>([](auto& state) { destroy(state); }, extender);
+  }
+
+  template<typename C>
+  void copy(Extender<C>& dst, const Extender<C>& src)
+  {
+    _visit<C>([](auto& dst, const auto& src) { copy(dst, src); }, dst, src);
+  }
+
+  template<typename C>
+  void simulate_pulse(Extender<C>& extender)
+  {
+    _visit<C>([](auto& state) { simulate_pulse(state); }, extender);
+  }
+
+  template<typename C>
+  bool equals(const Extender<C>& lhs, const Extender<C>& rhs)
+  {
+    return _visit<C>([](const auto& lhs, const auto& rhs) { return equals(lhs, rhs); },
+                     lhs, rhs);
+  }
+
+  template<typename C>
+  uint64_t fingerprint(const Extender<C>& extender)
+  {
+    return _visit<C>([](const auto& state) { return fingerprint(state); }, extender);
+  }
+
+  template<typename C>
+  void take_sample(const Extender<C>& extender, Sample& sample)
+  {
+    _visit<C>([&](const auto& state) { take_sample(state, sample); }, extender);
+  }
+
+  template<typename C>
+  void read_segments(const Extender<C>& extender, typename C::len_t* segments)
+  {
+    _visit<C>([&](const auto& state) { read_segments(state, segments); }, extender);
+  }
+
+  template<typename C>
+  bool finished(const Extender<C>& extender)
+  {
+    return _visit<C>([](const auto& state) { return finished(state); }, extender);
+  }
+
+  // Every extender in the range of constants.h, one length at a time. The
+  // sequences are offsets from the first length and period of the range.
+  template<uint32_t L, typename F, uint32_t... kPeriods>
+  inline bool _visit_periods(uint32_t period, F& f,
+                             std::integer_sequence<uint32_t, kPeriods...>)
+  {
+    return ((period == kMinPeriod + kPeriods &&
+             (f(Config<L, kMinPeriod + kPeriods>()), true)) || ...);
+  }
+
+  template<typename F, uint32_t... kLengths>
+  inline bool _visit_lengths(uint32_t length, uint32_t period, F& f,
+                             std::integer_sequence<uint32_t, kLengths...>)
+  {
+    return ((length == kMinLength + kLengths &&
+             _visit_periods<kMinLength + kLengths>(
+               period, f, std::make_integer_sequence<uint32_t, kMaxPeriod - kMinPeriod + 1>())) || ...);
+  }
+
+  template<typename F>
+  bool visit_config(uint32_t length, uint32_t period, F&& f)
+  {
+    if (length == kLength && period == kPeriod)
+    {
+      f(DefaultConfig());
+      return true;
+    }
+    return _visit_lengths(length, period, f,
+                          std::make_integer_sequence<uint32_t, kMaxLength - kMinLength + 1>());
+  }
+} // namespace snaperz
@@ -1,6 +1,6 @@
 #pragma once
 
-#if __AVX2__
+#if SNAPERZ_X86
 // The detailed guide on instructions in the AVX2 (and other) instruction
 // set can be found on the Intel reference:
 // https://www.intel.com/content/www/us/en/docs/intrinsics-guide/index.html
@@ -10,198 +10,264 @@
 #include <cassert>
 
 #include "constants.h"
+#include "snaperz_memory.h"
+#include "snaperz_fingerprint.h"
+#include "snaperz_windows.h"
 
-namespace snaperz
+// Compile this engine for AVX2 regardless of the flags used for the rest
+// of the program. The engine is only selected at runtime if the CPU supports
+// it, see snaperz_extender.h.
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+namespace snaperz::avx2
 {
-  // Hard limitation, since we only have implementations for <=16-bit elements.
-  static_assert(std::numeric_limits<len_t>::max() <= std::numeric_limits<uint16_t>::max(),
-                "Extender length must fit into a 16-bit uint");
+  // Hard limitation, since we only have implementations for <=32-bit elements.
+  // Longer extenders are simulated by one of the other engines instead.
+  template<typename C>
+  static constexpr bool kSupported =
+    std::numeric_limits<typename C::len_t>::max() <= std::numeric_limits<uint32_t>::max();
 
   template<typename T>
-  static constexpr T to_even(T value)
+  static constexpr T to_multiple(T value, T n)
   {
-    return value + (value & 0x1);
+    return (value + n - 1) / n * n;
   }
 
-  static constexpr uint32_t kElemCount = sizeof(__m256i) / sizeof(len_t);
-  static constexpr uint32_t kSegCount =
-    (kLength + 1 > 2 * kElemCount) ? kLength + 1 : to_even(kLength + 1);
+  // The windows are simulated in pairs of a current and a next window. Every
+  // pair holds its own set of pulses, and the pairs are independent within a
+  // single step, which allows the CPU to simulate them in parallel.
+  static_assert(kAvx2WindowCount >= 2 && kAvx2WindowCount % 2 == 0,
+                "The AVX2 window count must be an even number");
+  template<typename C>
+  static constexpr uint32_t kElemCount = sizeof(__m256i) / sizeof(typename C::len_t);
+  // Every step simulates all of the windows, so do not use more windows than
+  // required to hold the entire extender.
+  template<typename C>
+  static constexpr uint32_t kWindowCount =
+    std::min(kAvx2WindowCount, to_multiple((C::kLength + kElemCount<C>) / kElemCount<C>, UINT32_C(2)));
+  template<typename C>
+  static constexpr uint32_t kPairCount = kWindowCount<C> / 2;
+
+  // Whether the entire extender fits in the windows. In that case, the
+  // segments never have to leave the registers once the windows are
+  // saturated, see _simulate_resident_pulse. The unused segments at the end
+  // are always zero, so every element of the windows is in use.
+  template<typename C>
+  static constexpr bool kResident = C::kLength + 1 <= kWindowCount<C> * kElemCount<C>;
+  template<typename C>
+  static constexpr uint32_t kSegCount = kResident<C> ? kWindowCount<C> * kElemCount<C> : C::kLength + 1;
+  template<typename C>
   static constexpr uint32_t kSaturationCount =
-    std::min(kSegCount, 2 * kElemCount);
+    std::min(kSegCount<C>, kWindowCount<C> * kElemCount<C>);
+  // The number of elements in use in each window.
+  template<typename C>
+  static constexpr uint32_t kLaneCount = kSaturationCount<C> / kWindowCount<C>;
   
-  struct Extender
+  // Note: the alignment is explicit, since code compiled for other
+  //       instruction sets only aligns the registers to 16 bytes.
+  template<typename C>
+  struct alignas(sizeof(__m256i)) Extender
   {
-    len_t* segments;
-    // The odd and even active windows of the segments that are currently
-    // being simulated.
-    __m256i _windows[2];
+    typename C::len_t* segments;
+    // The active windows of the segments that are currently being simulated.
+    // Windows 2k and 2k + 1 are the current and next window of the k-th pair.
+    // Every step, the segments move down by one window, and the segments of
+    // the first window move into the last window (shifted by one element).
+    __m256i _windows[kWindowCount<C>];
     // Counters keeping track of how many blocks we have seen at that index
     // of the window. This is used to check if we are in the last segment.
-    __m256i _counter;
-    // A cached value of the _last_seg_mask values used during simulation of
-    // each step. This is use to check if the extender has finished.
-    __m256i _last_seg_masks[2];
-    // The parity bit defining which window is active
-    uint32_t parity_bit = 0b0;
+    // There is one counter for every pair of windows.
+    __m256i _counters[kPairCount<C>];
+    // A cached value of the _last_seg_mask values computed by the last step
+    // for every pair of windows. This is use to check if the extender has
+    // finished.
+    __m256i _last_seg_masks[kPairCount<C>];
     // The position of the sequence which is first in the active window.
     size_t p;
-    // The total number of steps that have been simulated.
+    // The total number of steps that have been simulated. This is no longer
+    // updated when resident, once the windows have been saturated.
     uint64_t steps;
+    // Whether the extender had finished after the last simulated pulse.
+    bool done;
+    // The fingerprint of the segments outside of the windows, which is
+    // compared by equals() before the segments, see snaperz_fingerprint.h.
+    uint64_t fingerprint;
+    // The keys of the fingerprint.
+    const uint64_t* keys;
   };
 
-  namespace avx2
+  // Moves the fingerprint along with the segments outside of the windows,
+  // which start at p. Every step, the segment at p enters the windows, and
+  // the segment that was just stored leaves them.
+  template<typename C>
+  inline void _update_fingerprint(Extender<C>& extender)
   {
-    template<typename T>
-    void _reverse(const __m256i& _value, __m256i& _dst);
-    
-    template<typename T>
-    void _right_shift(const __m256i& _value, __m256i& _dst);
-    
-    template<typename T>
-    void _simulate_step(Extender& extender);
-
-    template<typename T>
-    bool _finished(const Extender& extender);
+    static constexpr uint32_t cnt = kSegCount<C> - kSaturationCount<C>;
+    if constexpr (cnt != 0)
+    {
+      const auto i = (extender.p + cnt) % kSegCount<C>;
+      extender.fingerprint += extender.segments[i] * extender.keys[i] -
+                              extender.segments[extender.p] * extender.keys[extender.p];
+    }
+  }
 
-    template<typename T>
-    bool _equals(const Extender& lhs, const Extender& rhs);
+  template<typename T>
+  void _reverse(const __m256i& _value, __m256i& _dst);
+  
+  template<typename T>
+  void _right_shift(const __m256i& _value, __m256i& _dst);
+  
+  template<typename T>
+  void _right_rotate(const __m256i& _value, __m256i& _dst);
+  
+  // The parts of the implementation that depend on both the extender and
+  // the element type. These are specialized for every element type below.
+  template<typename C, typename T = typename C::len_t>
+  struct _Kernel;
 
 #if _DEBUG
-    template<class T>
-    inline void _DEBUG_log(const __m256i & value)
+  template<class T>
+  inline void _DEBUG_log(const __m256i & value)
+  {
+    const size_t n = sizeof(__m256i) / sizeof(T);
+    T buffer[n];
+    _mm256_storeu_si256((__m256i*)buffer, value);
+    for (uint32_t i = n; i-- != 0; )
     {
-      const size_t n = sizeof(__m256i) / sizeof(T);
-      T buffer[n];
-      _mm256_storeu_si256((__m256i*)buffer, value);
-      for (uint32_t i = n; i-- != 0; )
-      {
-        std::cout << +buffer[i] << " ";
-      }
-      std::cout << std::endl;
+      std::cout << +buffer[i] << " ";
     }
+    std::cout << std::endl;
+  }
 #endif
 
-    /* uint8_t implementation for AVX2 */
+  /* uint8_t implementation for AVX2 */
 
-    template<>
-    inline void _reverse<uint8_t>(const __m256i& _value, __m256i& _dst)
-    {
-      // Reverse bytes in value, i.e. compute:
-      //   V'[i] = V'[n - i - 1], forall n < i <= 0
-      //
-      // This operation is done with two instructions. The first instruction
-      // will reverse within the 128-bit lanes individually by using shuffle,
-      // and the other instruction will then permute 128-bit langes such that
-      // they are swapped. Below is a demonstration of this procedure:
-      //
-      //   V:
-      //     V[7], V[6], V[5], V[4], V[3], V[2], V[1], V[0].
-      //
-      //   Shuffle(V):
-      //     V[4], V[5], V[6], V[7], V[0], V[1], V[2], V[3].
-      //   Permute(Shuffle(V)):
-      //      V[0], V[1], V[2], V[3], V[4], V[5], V[6], V[7].
-
-      // Perform shuffle instruction
-      const __m256i _shuffle_control = _mm256_set_epi8(
-        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, // 1st 128-bit lane
-        0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15  // 2nd 128-bit lane
-      );
-      __m256i _tmp = _mm256_shuffle_epi8(_value, _shuffle_control);
-      // Perform the permutation, swapping the 128-bit lanes. The lower 4 bits
-      // of the control determine the lower half of the result, and upper 4 bits
-      // determine the upper half. In this case, we just select the 1st (upper
-      // half of first argument), and 0th (lower half of first argument) as the
-      // respective results.
-      _dst = _mm256_permute2x128_si256(_tmp, _tmp, 0x01);
-    }
+  template<>
+  inline void _reverse<uint8_t>(const __m256i& _value, __m256i& _dst)
+  {
+    // Reverse bytes in value, i.e. compute:
+    //   V'[i] = V'[n - i - 1], forall n < i <= 0
+    //
+    // This operation is done with two instructions. The first instruction
+    // will reverse within the 128-bit lanes individually by using shuffle,
+    // and the other instruction will then permute 128-bit langes such that
+    // they are swapped. Below is a demonstration of this procedure:
+    //
+    //   V:
+    //     V[7], V[6], V[5], V[4], V[3], V[2], V[1], V[0].
+    //
+    //   Shuffle(V):
+    //     V[4], V[5], V[6], V[7], V[0], V[1], V[2], V[3].
+    //   Permute(Shuffle(V)):
+    //      V[0], V[1], V[2], V[3], V[4], V[5], V[6], V[7].
+
+    // Perform shuffle instruction
+    const __m256i _shuffle_control = _mm256_set_epi8(
+      0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, // 1st 128-bit lane
+      0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15  // 2nd 128-bit lane
+    );
+    __m256i _tmp = _mm256_shuffle_epi8(_value, _shuffle_control);
+    // Perform the permutation, swapping the 128-bit lanes. The lower 4 bits
+    // of the control determine the lower half of the result, and upper 4 bits
+    // determine the upper half. In this case, we just select the 1st (upper
+    // half of first argument), and 0th (lower half of first argument) as the
+    // respective results.
+    _dst = _mm256_permute2x128_si256(_tmp, _tmp, 0x01);
+  }
 
-    template<>
-    inline void _right_shift<uint8_t>(const __m256i& _value, __m256i& _dst)
+  template<>
+  inline void _right_shift<uint8_t>(const __m256i& _value, __m256i& _dst)
+  {
+    // Shift the value right by 1 byte, i.e. compute:
+    //   V' = V >> 8
+    //     <==>
+    //   V'[i] = V[i + 1], forall n > i > 0
+    //   V'[n - 1] = 0
+    //
+    // This will be done in two operations. One operation will perform a
+    // logical shift-right on V. Since this operation is only performed
+    // within the 128-bit lanes, we will have some values that are zeroed
+    // out. In particular, V[n/2 - 1] and V[n - 1] will both be zeroed out.
+    // Therefore, we also need to restore V[n/2 - 1]. This can be done in
+    // several ways. We will restore it by reversing V, and transferring
+    // V[n/2] to V[n/2 - 1] by blending. Below is a demonstration:
+    //
+    //   V:
+    //     V[7], V[6], V[5], V[4], V[3], V[2], V[1], V[0].
+    //
+    //   RightShift(V, 1):
+    //        0, V[7], V[6], V[5],    0, V[3], V[2], V[1].
+    //   Reverse(V):
+    //     V[0], V[1], V[2], V[3], V[4], V[5], V[6], V[7].
+    //   Blend(RightShift(V, 1), Reverse(V)):
+    //        0, V[7], V[6], V[5], V[4], V[3], V[2], V[1].
+    //
+    // We can also perform a right rotation this way by blending
+    // back in V[0] as the most significant element.
+    
+    // Perform the right shift on _value first. This should allow the below
+    // reverse operation to be performed in parallel.
+    __m256i _tmp = _mm256_srli_si256(_value, 1);
+    // Reverse the value. This is done in multiple steps. Refer to _reverse
+    // for more info.
+    __m256i _rev;
+    _reverse<uint8_t>(_value, _rev);
+    // Blend the value with index 15 from the reverse into the value, i.e.
+    // only the 15th value should have the 7th bit set. Just use 0xFF, since
+    // the remaining bits are ignored.
+    const __m256i _mask = _mm256_set_epi8(
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+    );
+    _dst = _mm256_blendv_epi8(_tmp, _rev, _mask);
+  }
+
+  template<>
+  inline void _right_rotate<uint8_t>(const __m256i& _value, __m256i& _dst)
+  {
+    // Rotate the value right by 1 byte, i.e. compute:
+    //   V'[i] = V[i + 1], forall n > i > 0
+    //   V'[n - 1] = V[0]
+    //
+    // Unlike the shift above, this only requires two operations. We first
+    // swap the 128-bit lanes of V, and then concatenate every lane of V with
+    // the corresponding swapped lane, shifting the result right by 1 byte.
+    // Below is a demonstration:
+    //
+    //   V:
+    //     V[7], V[6], V[5], V[4], V[3], V[2], V[1], V[0].
+    //
+    //   Permute(V):
+    //     V[3], V[2], V[1], V[0], V[7], V[6], V[5], V[4].
+    //   AlignRight(Permute(V), V, 1):
+    //     V[0], V[7], V[6], V[5], V[4], V[3], V[2], V[1].
+    __m256i _tmp = _mm256_permute2x128_si256(_value, _value, 0x01);
+    _dst = _mm256_alignr_epi8(_tmp, _value, 1);
+  }
+
+  template<typename C>
+  struct _Kernel<C, uint8_t>
+  {
+    static inline __m256i _insert_last(const __m256i& _value, uint8_t value)
     {
-      // Shift the value right by 1 byte, i.e. compute:
-      //   V' = V >> 8
-      //     <==>
-      //   V'[i] = V[i + 1], forall n > i > 0
-      //   V'[n - 1] = 0
-      //
-      // This will be done in two operations. One operation will perform a
-      // logical shift-right on V. Since this operation is only performed
-      // within the 128-bit lanes, we will have some values that are zeroed
-      // out. In particular, V[n/2 - 1] and V[n - 1] will both be zeroed out.
-      // Therefore, we also need to restore V[n/2 - 1]. This can be done in
-      // several ways. We will restore it by reversing V, and transferring
-      // V[n/2] to V[n/2 - 1] by blending. Below is a demonstration:
-      //
-      //   V:
-      //     V[7], V[6], V[5], V[4], V[3], V[2], V[1], V[0].
-      //
-      //   RightShift(V, 1):
-      //        0, V[7], V[6], V[5],    0, V[3], V[2], V[1].
-      //   Reverse(V):
-      //     V[0], V[1], V[2], V[3], V[4], V[5], V[6], V[7].
-      //   Blend(RightShift(V, 1), Reverse(V)):
-      //        0, V[7], V[6], V[5], V[4], V[3], V[2], V[1].
-      //
-      // We can also perform a right rotation this way by blending
-      // back in V[0] as the most significant element.
-      
-      // Perform the right shift on _value first. This should allow the below
-      // reverse operation to be performed in parallel.
-      __m256i _tmp = _mm256_srli_si256(_value, 1);
-      // Reverse the value. This is done in multiple steps. Refer to _reverse
-      // for more info.
-      __m256i _rev;
-      _reverse<uint8_t>(_value, _rev);
-      // Blend the value with index 15 from the reverse into the value, i.e.
-      // only the 15th value should have the 7th bit set. Just use 0xFF, since
-      // the remaining bits are ignored.
-      const __m256i _mask = _mm256_set_epi8(
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-      );
-      _dst = _mm256_blendv_epi8(_tmp, _rev, _mask);
+      // Insert the value as the last element in use of the window.
+      return _mm256_insert_epi8(_value, value, kLaneCount<C> - 1);
     }
 
-    template<>
-    inline void _simulate_step<uint8_t>(Extender& extender)
+    static inline void _simulate_pair(__m256i& _curr, __m256i& _next, __m256i& _counter, __m256i& _last_seg_mask)
     {
       // Constants
       const __m256i _zeros = _mm256_setzero_si256();
       const __m256i _ones = _mm256_set1_epi8(1);
       
-      const __m256i _push_limit = _mm256_set1_epi8(kPushLimit);
-      const __m256i _last_push_limit = _mm256_set1_epi8(kLastPushLimit);
-      const __m256i _len_plus_one = _mm256_set1_epi8(kLength + 1);
-
-      // Compute reference to current (C) and next (N) segment(s). Also flip
-      // the parity bit to prepare for next iteration.
-      __m256i& _curr = extender._windows[extender.parity_bit];
-      __m256i& _next = extender._windows[extender.parity_bit ^= 0b1];
-      __m256i& _last_seg_mask = extender._last_seg_masks[extender.parity_bit];
-      // Store the result in the extender segments, so we can use it the next
-      // time the window passes this value (since it will be gone after the
-      // right shift below). Only do this once we have saturated the windows.
-      if (extender.steps >= kSaturationCount)
-      {
-        // Compute the sequence index of the first element in the window.
-        const auto i = (extender.p + (kSegCount - kSaturationCount)) % kSegCount;
-        extender.segments[i] = static_cast<uint8_t>(_mm256_cvtsi256_si32(_next));
-      }
-      // Shift the next segment one to the right. This will have the effect
-      // of actually making it the next segment (it is the previous segment
-      // at the start of this iteration).
-      _right_shift<uint8_t>(_next, _next);
-      // Insert the next segment (after the last current element) into the
-      // window, as the last element.
-      const auto next_length = extender.segments[extender.p];
-      static constexpr auto kLastElem = std::min(UINT32_C(31), kSaturationCount / 2 - 1);
-      _next = _mm256_insert_epi8(_next, next_length, kLastElem);
+      const __m256i _push_limit = _mm256_set1_epi8(C::kPushLimit);
+      const __m256i _last_push_limit = _mm256_set1_epi8(C::kLastPushLimit);
+      const __m256i _len_plus_one = _mm256_set1_epi8(static_cast<char>(C::kLength + 1));
 
       // Figure out if we are in the last segment.
-      __m256i& _counter = extender._counter;
       // Increase the counter by the number of blocks in the current segment
       _counter = _mm256_add_epi8(_counter, _curr);
       // Check if the counter is kLength + 1, i.e. we are the last segment
@@ -260,29 +326,30 @@ namespace snaperz
       // we will never have any blocks in the following segments (essentially
       // allows for an efficient reset of the counter).
       _counter = _mm256_andnot_si256(_last_seg_mask, _counter);
-
-      extender.p = (extender.p + 1) % kSegCount;
-      extender.steps++;
     }
 
-    template<>
-    inline bool _finished<uint8_t>(const Extender& extender)
+    static inline bool _finished(const Extender<C>& extender)
     {
-      // Compute the index of the first segment in the currently active window.
-      assert(0 <= extender.p && extender.p <= kSaturationCount);
+      // Compute the index of the first segment in the currently active windows,
+      // counting the elements of all windows in order.
+      assert(0 <= extender.p && extender.p <= kSaturationCount<C>);
+      // Since a pulse consists of two steps, the first segment is always in one
+      // of the current windows, i.e. it was just simulated by the last step.
+      assert((extender.p & 0x1) == 0);
       // Special case where extender.p might wrap to zero, in which case the
       // result should also be zero. This is also relevant if this is called
       // before the extender has simulated the first pulse.
-      uint32_t first_seg_index = (extender.p > 0) * (kSaturationCount - extender.p) / 2;
-      // Compute the parity, i.e. the window that contains the first segment.
-      const uint32_t parity = extender.parity_bit ^ (extender.p & 0x1);
-      const __m256i& _last_seg_mask = extender._last_seg_masks[parity];
+      const uint32_t index = (extender.p > 0) * (kSaturationCount<C> - extender.p);
+      // Compute the element and the pair of windows that contain the first
+      // segment.
+      const uint32_t first_seg_index = index / kWindowCount<C>;
+      const uint32_t pair = (index % kWindowCount<C>) / 2;
+      const __m256i& _last_seg_mask = extender._last_seg_masks[pair];
       // We are done once the first segment is also the last segment.
-      return _mm256_movemask_epi8(_last_seg_mask) & (1 << first_seg_index);
+      return _mm256_movemask_epi8(_last_seg_mask) & (UINT32_C(1) << first_seg_index);
     }
 
-    template<>
-    inline bool _equals<uint8_t>(const Extender& lhs, const Extender& rhs)
+    static inline bool _equals(const Extender<C>& lhs, const Extender<C>& rhs)
     {
       // The extenders are equal if (1) their currently active pulses are at
       // the same segments, and that the segments (2) inside (in the registers)
@@ -293,7 +360,7 @@ namespace snaperz
         return false;
       }
       // (2) Active windows are equal
-      for (uint32_t i = 0; i < 2; i++)
+      for (uint32_t i = 0; i < kWindowCount<C>; i++)
       {
         __m256i _window_equal = _mm256_cmpeq_epi8(lhs._windows[i], rhs._windows[i]);
         if (~_mm256_movemask_epi8(_window_equal))
@@ -304,75 +371,74 @@ namespace snaperz
         }
       }
       // (3) Segments outside windows are equal
-      static constexpr size_t cnt = kSegCount - kSaturationCount;
+      static constexpr size_t cnt = kSegCount<C> - kSaturationCount<C>;
       if constexpr (cnt != 0)
       {
-        assert(0 <= lhs.p && lhs.p <= kSaturationCount);
+        assert(0 <= lhs.p && lhs.p <= kSaturationCount<C>);
         const auto lhs_start = lhs.segments + lhs.p;
         const auto rhs_start = rhs.segments + rhs.p;
         return std::memcmp(lhs_start, rhs_start, cnt * sizeof(uint8_t)) == 0;
       }
       return true;
     }
-    
-    /* uint16_t implementation for AVX2 */
+  };
+  
+  /* uint16_t implementation for AVX2 */
 
-    template<>
-    inline void _reverse<uint16_t>(const __m256i& _value, __m256i& _dst)
-    {
-      // See uint8_t version for implementation details.
-      const __m256i _shuffle_control = _mm256_set_epi8(
-        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14, // 1st 128-bit lane
-        1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14  // 2nd 128-bit lane
-      );
-      __m256i _tmp = _mm256_shuffle_epi8(_value, _shuffle_control);
-      _dst = _mm256_permute2x128_si256(_tmp, _tmp, 0x01);
-    }
+  template<>
+  inline void _reverse<uint16_t>(const __m256i& _value, __m256i& _dst)
+  {
+    // See uint8_t version for implementation details.
+    const __m256i _shuffle_control = _mm256_set_epi8(
+      1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14, // 1st 128-bit lane
+      1, 0, 3, 2, 5, 4, 7, 6, 9, 8, 11, 10, 13, 12, 15, 14  // 2nd 128-bit lane
+    );
+    __m256i _tmp = _mm256_shuffle_epi8(_value, _shuffle_control);
+    _dst = _mm256_permute2x128_si256(_tmp, _tmp, 0x01);
+  }
 
-    template<>
-    inline void _right_shift<uint16_t>(const __m256i& _value, __m256i& _dst)
+  template<>
+  inline void _right_shift<uint16_t>(const __m256i& _value, __m256i& _dst)
+  {
+    // See uint8_t version for implementation details.
+    __m256i _tmp = _mm256_srli_si256(_value, sizeof(uint16_t));
+    __m256i _rev;
+    _reverse<uint16_t>(_value, _rev);
+    const __m256i _mask = _mm256_set_epi8(
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+      0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
+    );
+    _dst = _mm256_blendv_epi8(_tmp, _rev, _mask);
+  }
+
+  template<>
+  inline void _right_rotate<uint16_t>(const __m256i& _value, __m256i& _dst)
+  {
+    // See uint8_t version for implementation details.
+    __m256i _tmp = _mm256_permute2x128_si256(_value, _value, 0x01);
+    _dst = _mm256_alignr_epi8(_tmp, _value, sizeof(uint16_t));
+  }
+
+  template<typename C>
+  struct _Kernel<C, uint16_t>
+  {
+    static inline __m256i _insert_last(const __m256i& _value, uint16_t value)
     {
-      // See uint8_t version for implementation details.
-      __m256i _tmp = _mm256_srli_si256(_value, sizeof(uint16_t));
-      __m256i _rev;
-      _reverse<uint16_t>(_value, _rev);
-      const __m256i _mask = _mm256_set_epi8(
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0xFF, 0xFF, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
-        0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00
-      );
-      _dst = _mm256_blendv_epi8(_tmp, _rev, _mask);
+      return _mm256_insert_epi16(_value, value, kLaneCount<C> - 1);
     }
 
-    template<>
-    inline void _simulate_step<uint16_t>(Extender& extender)
+    static inline void _simulate_pair(__m256i& _curr, __m256i& _next, __m256i& _counter, __m256i& _last_seg_mask)
     {
       // See uint8_t version for implementation details.
       const __m256i _zeros = _mm256_setzero_si256();
       const __m256i _ones = _mm256_set1_epi16(1);
       
-      const __m256i _push_limit = _mm256_set1_epi16(kPushLimit);
-      const __m256i _last_push_limit = _mm256_set1_epi16(kLastPushLimit);
-      const __m256i _len_plus_one = _mm256_set1_epi16(kLength + 1);
+      const __m256i _push_limit = _mm256_set1_epi16(C::kPushLimit);
+      const __m256i _last_push_limit = _mm256_set1_epi16(C::kLastPushLimit);
+      const __m256i _len_plus_one = _mm256_set1_epi16(static_cast<short>(C::kLength + 1));
 
-      __m256i& _curr = extender._windows[extender.parity_bit];
-      __m256i& _next = extender._windows[extender.parity_bit ^= 0b1];
-      __m256i& _last_seg_mask = extender._last_seg_masks[extender.parity_bit];
-
-      if (extender.steps >= kSaturationCount)
-      {
-        const auto i = (extender.p + (kSegCount - kSaturationCount)) % kSegCount;
-        extender.segments[i] = static_cast<uint16_t>(_mm256_cvtsi256_si32(_next));
-      }
-      
-      _right_shift<uint16_t>(_next, _next);
-      
-      const auto next_length = extender.segments[extender.p];
-      static constexpr auto kLastElem = std::min(UINT32_C(15), kSaturationCount / 2 - 1);
-      _next = _mm256_insert_epi16(_next, next_length, kLastElem);
-      
-      __m256i& _counter = extender._counter;
       _counter = _mm256_add_epi16(_counter, _curr);
       _last_seg_mask = _mm256_cmpeq_epi16(_counter, _len_plus_one);
 
@@ -399,32 +465,29 @@ namespace snaperz
       _counter = _mm256_add_epi16(_counter, _delta);
       _last_seg_mask = _mm256_cmpeq_epi16(_counter, _len_plus_one);
       _counter = _mm256_andnot_si256(_last_seg_mask, _counter);
-
-      extender.p = (extender.p + 1) % kSegCount;
-      extender.steps++;
     }
 
-    template<>
-    inline bool _finished<uint16_t>(const Extender& extender)
+    static inline bool _finished(const Extender<C>& extender)
     {
       // See uint8_t version for implementation details.
-      assert(0 <= extender.p && extender.p <= kSaturationCount);
-      uint32_t first_seg_index = (extender.p > 0) * (kSaturationCount - extender.p) / 2;
-      const uint32_t parity = extender.parity_bit ^ (extender.p & 0x1);
-      const __m256i& _last_seg_mask = extender._last_seg_masks[parity];
+      assert(0 <= extender.p && extender.p <= kSaturationCount<C>);
+      assert((extender.p & 0x1) == 0);
+      const uint32_t index = (extender.p > 0) * (kSaturationCount<C> - extender.p);
+      const uint32_t first_seg_index = index / kWindowCount<C>;
+      const uint32_t pair = (index % kWindowCount<C>) / 2;
+      const __m256i& _last_seg_mask = extender._last_seg_masks[pair];
       // Note: should be shifted twice as far over due to 16-bit versus 8-bit.
-      return _mm256_movemask_epi8(_last_seg_mask) & (1 << (2 * first_seg_index));
+      return _mm256_movemask_epi8(_last_seg_mask) & (UINT32_C(1) << (2 * first_seg_index));
     }
 
-    template<>
-    inline bool _equals<uint16_t>(const Extender& lhs, const Extender& rhs)
+    static inline bool _equals(const Extender<C>& lhs, const Extender<C>& rhs)
     {
       // See uint8_t version for implementation details.
       if (lhs.p != rhs.p)
       {
         return false;
       }
-      for (uint32_t i = 0; i < 2; i++)
+      for (uint32_t i = 0; i < kWindowCount<C>; i++)
       {
         __m256i _window_equal = _mm256_cmpeq_epi16(lhs._windows[i], rhs._windows[i]);
         if (~_mm256_movemask_epi8(_window_equal))
@@ -432,72 +495,359 @@ namespace snaperz
           return false;
         }
       }
-      static constexpr size_t cnt = kSegCount - kSaturationCount;
+      static constexpr size_t cnt = kSegCount<C> - kSaturationCount<C>;
       if constexpr (cnt != 0)
       {
-        assert(0 <= lhs.p && lhs.p <= kSaturationCount);
+        assert(0 <= lhs.p && lhs.p <= kSaturationCount<C>);
         const auto lhs_start = lhs.segments + lhs.p;
         const auto rhs_start = rhs.segments + rhs.p;
         return std::memcmp(lhs_start, rhs_start, cnt * sizeof(uint16_t)) == 0;
       }
       return true;
     }
-  } // namespace avx2
+  };
 
-  Extender create()
+  /* uint32_t implementation for AVX2 */
+
+  template<>
+  inline void _reverse<uint32_t>(const __m256i& _value, __m256i& _dst)
   {
-    Extender extender;
-    extender.segments = new len_t[kSegCount];
-    for (uint32_t i = 0; i < kSegCount; i++)
+    // Unlike the smaller elements, 32-bit elements can be permuted across
+    // the 128-bit lanes directly.
+    const __m256i _permute_control = _mm256_set_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    _dst = _mm256_permutevar8x32_epi32(_value, _permute_control);
+  }
+
+  template<>
+  inline void _right_rotate<uint32_t>(const __m256i& _value, __m256i& _dst)
+  {
+    // Unlike the smaller elements, a single permutation suffices.
+    const __m256i _permute_control = _mm256_set_epi32(0, 7, 6, 5, 4, 3, 2, 1);
+    _dst = _mm256_permutevar8x32_epi32(_value, _permute_control);
+  }
+
+  template<>
+  inline void _right_shift<uint32_t>(const __m256i& _value, __m256i& _dst)
+  {
+    // Rotate the elements with a single permutation, and then blend in a
+    // zero as the last element.
+    __m256i _tmp;
+    _right_rotate<uint32_t>(_value, _tmp);
+    _dst = _mm256_blend_epi32(_tmp, _mm256_setzero_si256(), 0x80);
+  }
+
+  template<typename C>
+  struct _Kernel<C, uint32_t>
+  {
+    static inline __m256i _insert_last(const __m256i& _value, uint32_t value)
     {
-      // Note: there are sometimes trailing segments with zeros.
-      extender.segments[i] = (i <= kLength) ? 1 : 0;
+      return _mm256_insert_epi32(_value, static_cast<int>(value), kLaneCount<C> - 1);
+    }
+
+    static inline void _simulate_pair(__m256i& _curr, __m256i& _next, __m256i& _counter, __m256i& _last_seg_mask)
+    {
+      // See uint8_t version for implementation details.
+      const __m256i _zeros = _mm256_setzero_si256();
+      const __m256i _ones = _mm256_set1_epi32(1);
+      
+      const __m256i _push_limit = _mm256_set1_epi32(C::kPushLimit);
+      const __m256i _last_push_limit = _mm256_set1_epi32(C::kLastPushLimit);
+      const __m256i _len_plus_one = _mm256_set1_epi32(static_cast<int>(C::kLength + 1));
+
+      _counter = _mm256_add_epi32(_counter, _curr);
+      _last_seg_mask = _mm256_cmpeq_epi32(_counter, _len_plus_one);
+
+      // Handle pushing case:
+
+      __m256i _curr_minus_one = _mm256_sub_epi32(_curr, _ones);
+      __m256i _curr_push_limit = _mm256_blendv_epi8(_push_limit, _last_push_limit, _last_seg_mask);
+      __m256i _push_delta = _mm256_min_epu32(_curr_push_limit, _curr_minus_one);
+      
+      __m256i _equal_one_mask = _mm256_cmpeq_epi32(_curr, _ones);
+      _push_delta = _mm256_andnot_si256(_equal_one_mask, _push_delta);
+      __m256i _equal_zero_mask = _mm256_cmpeq_epi32(_curr, _zeros);
+      _push_delta = _mm256_andnot_si256(_equal_zero_mask, _push_delta);
+
+      // Handle pulling case:
+      
+      __m256i _pull_delta = _mm256_andnot_si256(_last_seg_mask, _next);
+      _pull_delta = _mm256_and_si256(_equal_one_mask, _pull_delta);
+
+      __m256i _delta = _mm256_sub_epi32(_pull_delta, _push_delta);
+      _curr = _mm256_add_epi32(_curr, _delta);
+      _next = _mm256_sub_epi32(_next, _delta);
+
+      _counter = _mm256_add_epi32(_counter, _delta);
+      _last_seg_mask = _mm256_cmpeq_epi32(_counter, _len_plus_one);
+      _counter = _mm256_andnot_si256(_last_seg_mask, _counter);
+    }
+
+    static inline bool _finished(const Extender<C>& extender)
+    {
+      // See uint8_t version for implementation details.
+      assert(0 <= extender.p && extender.p <= kSaturationCount<C>);
+      assert((extender.p & 0x1) == 0);
+      const uint32_t index = (extender.p > 0) * (kSaturationCount<C> - extender.p);
+      const uint32_t first_seg_index = index / kWindowCount<C>;
+      const uint32_t pair = (index % kWindowCount<C>) / 2;
+      const __m256i& _last_seg_mask = extender._last_seg_masks[pair];
+      // Note: should be shifted four times as far over due to 32-bit versus 8-bit.
+      return _mm256_movemask_epi8(_last_seg_mask) & (UINT32_C(1) << (4 * first_seg_index));
+    }
+
+    static inline bool _equals(const Extender<C>& lhs, const Extender<C>& rhs)
+    {
+      // See uint8_t version for implementation details.
+      if (lhs.p != rhs.p)
+      {
+        return false;
+      }
+      for (uint32_t i = 0; i < kWindowCount<C>; i++)
+      {
+        __m256i _window_equal = _mm256_cmpeq_epi32(lhs._windows[i], rhs._windows[i]);
+        if (~_mm256_movemask_epi8(_window_equal))
+        {
+          return false;
+        }
+      }
+      static constexpr size_t cnt = kSegCount<C> - kSaturationCount<C>;
+      if constexpr (cnt != 0)
+      {
+        assert(0 <= lhs.p && lhs.p <= kSaturationCount<C>);
+        const auto lhs_start = lhs.segments + lhs.p;
+        const auto rhs_start = rhs.segments + rhs.p;
+        return std::memcmp(lhs_start, rhs_start, cnt * sizeof(uint32_t)) == 0;
+      }
+      return true;
+    }
+  };
+
+  template<typename C>
+  inline void _simulate_windows(Extender<C>& extender, const __m256i& _last)
+  {
+    // Move every other window down by one, and move the given segments into
+    // the last window. The number of windows is known at compile time, so
+    // this is only a renaming of registers.
+    for (uint32_t i = 0; i < kWindowCount<C> - 1; i++)
+    {
+      extender._windows[i] = extender._windows[i + 1];
     }
-    // Reset the two windows, and the parity bit:
+    extender._windows[kWindowCount<C> - 1] = _last;
+
+    // Simulate every pair of current and next windows.
+    for (uint32_t i = 0; i < kPairCount<C>; i++)
+    {
+      _Kernel<C>::_simulate_pair(
+        extender._windows[2 * i],
+        extender._windows[2 * i + 1],
+        extender._counters[i],
+        extender._last_seg_masks[i]
+      );
+    }
+  }
+
+  template<typename C>
+  inline void _simulate_step(Extender<C>& extender)
+  {
+    // The first window contains the segments that the pulses are done with.
+    // Its segments move into the last window, shifted by one element, where
+    // they become the next segments of the last pair.
+    __m256i _last = extender._windows[0];
+    // Store the result in the extender segments, so we can use it the next
+    // time the window passes this value (since it will be gone after the
+    // right shift below). Only do this once we have saturated the windows.
+    if (extender.steps >= kSaturationCount<C>)
+    {
+      // Compute the sequence index of the first element in the window.
+      const auto i = (extender.p + (kSegCount<C> - kSaturationCount<C>)) % kSegCount<C>;
+      extender.segments[i] = static_cast<typename C::len_t>(_mm256_cvtsi256_si32(_last));
+    }
+    // Shift the window one to the right, and insert the next segment (after
+    // the last current element) into the window, as the last element.
+    _right_shift<typename C::len_t>(_last, _last);
+    _last = _Kernel<C>::_insert_last(_last, extender.segments[extender.p]);
+    _simulate_windows(extender, _last);
+
+    _update_fingerprint(extender);
+    extender.p = (extender.p + 1) % kSegCount<C>;
+    extender.steps++;
+  }
+
+  template<typename C>
+  inline void _simulate_resident_pulse(Extender<C>& extender)
+  {
+    // Once the windows are saturated, the segment leaving the first window
+    // is stored and then loaded again as the segment entering the last
+    // window, since every segment is in the windows. Rotating the first
+    // window instead keeps the segments in registers, and the ring position
+    // is only required to find the first segment.
     for (uint32_t i = 0; i < 2; i++)
+    {
+      __m256i _last;
+      _right_rotate<typename C::len_t>(extender._windows[0], _last);
+      _simulate_windows(extender, _last);
+    }
+    extender.p = (extender.p + 2) % kSegCount<C>;
+  }
+
+  template<typename C>
+  inline Extender<C> create()
+  {
+    Extender<C> extender;
+    extender.segments = allocate<typename C::len_t>(kSegCount<C>);
+    for (uint32_t i = 0; i < kSegCount<C>; i++)
+    {
+      // Note: there are sometimes trailing segments with zeros.
+      extender.segments[i] = (i <= C::kLength) ? 1 : 0;
+    }
+    // Reset the windows:
+    for (uint32_t i = 0; i < kWindowCount<C>; i++)
     {
       extender._windows[i] = _mm256_setzero_si256();
+    }
+    for (uint32_t i = 0; i < kPairCount<C>; i++)
+    {
+      extender._counters[i] = _mm256_setzero_si256();
       extender._last_seg_masks[i] = _mm256_setzero_si256();
     }
-    extender._counter = _mm256_setzero_si256();
-    extender.parity_bit = 0b0;
+    extender.keys = fingerprint_keys<kSegCount<C>>();
+    extender.fingerprint = 0;
+    for (uint32_t i = 0; i < kSegCount<C> - kSaturationCount<C>; i++)
+    {
+      extender.fingerprint += extender.segments[i] * extender.keys[i];
+    }
     extender.p = 0;
     extender.steps = 0;
+    extender.done = false;
     return std::move(extender);
   }
 
-  void destroy(Extender& extender)
+  template<typename C>
+  inline void destroy(Extender<C>& extender)
   {
-    delete[] extender.segments;
+    deallocate(extender.segments, kSegCount<C>);
     extender.segments = nullptr;
   }
 
-  void simulate_pulse(Extender& extender)
+  // Copies the state of the given extender into another extender, e.g. to
+  // take a snapshot of it. The registers are copied as they are, so the copy
+  // continues with the same phase.
+  template<typename C>
+  inline void copy(Extender<C>& dst, const Extender<C>& src)
   {
-    // Make sure that we fit another pulse in the currently active window.
+    typename C::len_t* segments = dst.segments;
+    dst = src;
+    dst.segments = segments;
+    std::memcpy(segments, src.segments, kSegCount<C> * sizeof(typename C::len_t));
+  }
+
+  // Writes the lengths of the kLength + 1 segments of the extender to the
+  // given array, as they are once every pulse simulated so far is complete.
+  // This is the same array for every engine, e.g. the segments of the
+  // fallback engine, regardless of the phase of the windows, which allows
+  // comparing the extender with others, or storing it, see create(). The
+  // pulses in the windows are completed by snaperz_windows.h.
+  template<typename C>
+  inline void read_segments(const Extender<C>& extender, typename C::len_t* dst)
+  {
+    typedef typename C::len_t len_t;
+    len_t windows[kWindowCount<C>][kElemCount<C>];
+    len_t counters[kPairCount<C>][kElemCount<C>];
+    for (uint32_t i = 0; i < kWindowCount<C>; i++)
+    {
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(windows[i]), extender._windows[i]);
+    }
+    for (uint32_t i = 0; i < kPairCount<C>; i++)
+    {
+      _mm256_storeu_si256(reinterpret_cast<__m256i*>(counters[i]), extender._counters[i]);
+    }
+    read_window_segments<C, kSegCount<C>, kSaturationCount<C>>(
+      extender.segments, extender.p, extender.steps, windows, counters, dst);
+  }
+
+  // Creates an extender with the given kLength + 1 segments, e.g. ones
+  // written by read_segments(), which is the inverse of this function.
+  template<typename C>
+  inline Extender<C> create(const typename C::len_t* segments)
+  {
+    // A new extender has no pulses in the windows yet, so only the segments
+    // in memory differ.
+    Extender<C> extender = create<C>();
+    std::memcpy(extender.segments, segments, (C::kLength + 1) * sizeof(typename C::len_t));
+    extender.fingerprint = 0;
+    for (uint32_t i = 0; i < kSegCount<C> - kSaturationCount<C>; i++)
+    {
+      extender.fingerprint += extender.segments[i] * extender.keys[i];
+    }
+    extender.done = segments[0] == C::kLength + 1;
+    return std::move(extender);
+  }
+
+  template<typename C>
+  inline void simulate_pulse(Extender<C>& extender)
+  {
+    if constexpr (kResident<C>)
+    {
+      // The windows are only saturated after the first kSaturationCount
+      // steps. Until then, the segments are loaded from memory.
+      if (extender.steps >= kSaturationCount<C>)
+      {
+        _simulate_resident_pulse(extender);
+        // Check if we are done while the last segment masks are still in
+        // registers.
+        extender.done = _Kernel<C>::_finished(extender);
+        return;
+      }
+    }
+    // Make sure that we fit another pulse in the currently active windows.
     // Otherwise, simulate until we have finished the current pulses (or
-    // at least the oldest one of the ones in the active window).
-    while (extender.p >= kSaturationCount)
+    // at least the oldest one of the ones in the active windows).
+    while (extender.p >= kSaturationCount<C>)
     {
       // Simulate the rest of the extender.
-      avx2::_simulate_step<len_t>(extender);
+      _simulate_step(extender);
     }
     // Actually simulate the next pulse.
-    avx2::_simulate_step<len_t>(extender);
-    avx2::_simulate_step<len_t>(extender);
+    _simulate_step(extender);
+    _simulate_step(extender);
+    extender.done = _Kernel<C>::_finished(extender);
+  }
+
+  template<typename C>
+  inline bool equals(const Extender<C>& lhs, const Extender<C>& rhs)
+  {
+    // Only compare the segments if their fingerprints match.
+    return lhs.fingerprint == rhs.fingerprint && _Kernel<C>::_equals(lhs, rhs);
   }
 
-  bool equals(const Extender& lhs, const Extender& rhs)
+  // Copies the windows as they are, rather than completing the pulses in
+  // them, see snaperz_fingerprint.h.
+  template<typename C>
+  inline void take_sample(const Extender<C>& extender, Sample& sample)
   {
-    return avx2::_equals<len_t>(lhs, rhs);
+    // Every sample of a loop check sees the same phase, see constants.h.
+    static_assert(LOOP_CHECK_INTERVAL % (kSaturationCount<C> / 2) == 0,
+                  "The phase of the windows must repeat between loop samples");
+    take_window_sample(extender.fingerprint, extender.p, extender._windows, sample);
   }
 
-  bool finished(const Extender& extender)
+  template<typename C>
+  inline uint64_t fingerprint(const Extender<C>& extender)
   {
-    return avx2::_finished<len_t>(extender);
+    Sample sample;
+    take_sample(extender, sample);
+    return sample_fingerprint(sample);
   }
-} // namespace snaperz
-#else // __AVX2__
+
+  template<typename C>
+  inline bool finished(const Extender<C>& extender)
+  {
+    return extender.done;
+  }
+} // namespace snaperz::avx2
+
+#pragma GCC pop_options
+#else // SNAPERZ_X86
 // There is a bug in snaperz_extender.h if this happens.
-#error "Requires AVX2 support."
-#endif // !__AVX2__
+#error "Requires an x86 target."
+#endif // !SNAPERZ_X86
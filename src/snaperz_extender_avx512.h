@@ -0,0 +1,469 @@
+#pragma once
+
+#if SNAPERZ_X86
+// This implementation mirrors the AVX2 implementation in snaperz_extender_avx2.h
+// closely, but operates on 512-bit windows. Refer to that file for a detailed
+// description of the algorithm. The main difference is that comparisons in
+// AVX-512 produce mask registers rather than vectors, which allows us to fold
+// most of the masking directly into the arithmetic instructions.
+#include <immintrin.h>
+#include <type_traits>
+#include <cstring>
+#include <cassert>
+
+#include "constants.h"
+#include "snaperz_memory.h"
+#include "snaperz_fingerprint.h"
+#include "snaperz_windows.h"
+
+// Compile this engine for AVX-512BW regardless of the flags used for the rest
+// of the program. The engine is only selected at runtime if the CPU supports
+// it, see snaperz_extender.h.
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw")
+
+namespace snaperz::avx512
+{
+  // Hard limitation, since we only have implementations for <=16-bit elements.
+  // Longer extenders are simulated by one of the other engines instead.
+  template<typename C>
+  static constexpr bool kSupported =
+    std::numeric_limits<typename C::len_t>::max() <= std::numeric_limits<uint16_t>::max();
+
+  template<typename C>
+  static constexpr uint32_t kElemCount = sizeof(__m512i) / sizeof(typename C::len_t);
+  // Extenders that fit in the windows are padded with zero segments to fill
+  // them, like the resident extenders of the AVX2 implementation. The phase
+  // of the windows then repeats every kSaturationCount / 2 pulses, see
+  // fingerprint().
+  template<typename C>
+  static constexpr uint32_t kSegCount =
+    (C::kLength + 1 > 2 * kElemCount<C>) ? C::kLength + 1 : 2 * kElemCount<C>;
+  template<typename C>
+  static constexpr uint32_t kSaturationCount =
+    std::min(kSegCount<C>, 2 * kElemCount<C>);
+
+  // Note: the alignment is explicit, since code compiled for other
+  //       instruction sets only aligns the registers to 16 bytes.
+  template<typename C>
+  struct alignas(sizeof(__m512i)) Extender
+  {
+    typename C::len_t* segments;
+    // The odd and even active windows of the segments that are currently
+    // being simulated.
+    __m512i _windows[2];
+    // Counters keeping track of how many blocks we have seen at that index
+    // of the window. This is used to check if we are in the last segment.
+    __m512i _counter;
+    // A cached value of the _last_seg_mask values used during simulation of
+    // each step. Each bit corresponds to an element of the window (only the
+    // lower 32 bits are used for 16-bit elements).
+    uint64_t _last_seg_masks[2];
+    // The parity bit defining which window is active
+    uint32_t parity_bit;
+    // The position of the sequence which is first in the active window.
+    size_t p;
+    // The total number of steps that have been simulated.
+    uint64_t steps;
+    // The fingerprint of the segments outside of the windows, which is
+    // compared by equals() before the segments, see snaperz_fingerprint.h.
+    uint64_t fingerprint;
+    // The keys of the fingerprint.
+    const uint64_t* keys;
+  };
+
+  // Moves the fingerprint along with the segments outside of the windows,
+  // which start at p. Every step, the segment at p enters the windows, and
+  // the segment that was just stored leaves them.
+  template<typename C>
+  inline void _update_fingerprint(Extender<C>& extender)
+  {
+    static constexpr uint32_t cnt = kSegCount<C> - kSaturationCount<C>;
+    if constexpr (cnt != 0)
+    {
+      const auto i = (extender.p + cnt) % kSegCount<C>;
+      extender.fingerprint += extender.segments[i] * extender.keys[i] -
+                              extender.segments[extender.p] * extender.keys[extender.p];
+    }
+  }
+
+  template<typename T>
+  void _right_shift(const __m512i& _value, __m512i& _dst);
+
+  // The parts of the implementation that depend on both the extender and
+  // the element type. These are specialized for every element type below.
+  template<typename C, typename T = typename C::len_t>
+  struct _Kernel;
+
+#if _DEBUG
+  template<class T>
+  inline void _DEBUG_log(const __m512i & value)
+  {
+    const size_t n = sizeof(__m512i) / sizeof(T);
+    T buffer[n];
+    _mm512_storeu_si512((__m512i*)buffer, value);
+    for (uint32_t i = n; i-- != 0; )
+    {
+      std::cout << +buffer[i] << " ";
+    }
+    std::cout << std::endl;
+  }
+#endif
+
+  /* uint8_t implementation for AVX-512 */
+
+  template<>
+  inline void _right_shift<uint8_t>(const __m512i& _value, __m512i& _dst)
+  {
+    // Shift the value right by 1 byte, i.e. compute:
+    //   V'[i] = V[i + 1], forall n > i > 0
+    //   V'[n - 1] = 0
+    //
+    // Unlike AVX2, we do not have to reverse the value to restore the
+    // elements that cross the 128-bit lanes. Instead, we first shift the
+    // entire value right by one 128-bit lane (filling with zeros), such that
+    // lane l of the result contains lane l + 1 of V. Then, the in-lane byte
+    // alignment concatenates lane l + 1 and lane l of V, and shifts the pair
+    // right by a single byte. Below is a demonstration (with 4 lanes of 2):
+    //
+    //   V:
+    //     V[7], V[6], V[5], V[4], V[3], V[2], V[1], V[0].
+    //
+    //   LaneShift(V, 1):
+    //        0,    0, V[7], V[6], V[5], V[4], V[3], V[2].
+    //   Align(LaneShift(V, 1), V, 1):
+    //        0, V[7], V[6], V[5], V[4], V[3], V[2], V[1].
+    const __m512i _tmp = _mm512_alignr_epi32(_mm512_setzero_si512(), _value, 4);
+    _dst = _mm512_alignr_epi8(_tmp, _value, 1);
+  }
+
+  template<typename C>
+  struct _Kernel<C, uint8_t>
+  {
+    static inline void _simulate_step(Extender<C>& extender)
+    {
+      // Constants
+      const __m512i _ones = _mm512_set1_epi8(1);
+
+      const __m512i _push_limit = _mm512_set1_epi8(C::kPushLimit);
+      const __m512i _last_push_limit = _mm512_set1_epi8(C::kLastPushLimit);
+      const __m512i _len_plus_one = _mm512_set1_epi8(C::kLength + 1);
+
+      // Compute reference to current (C) and next (N) segment(s). Also flip
+      // the parity bit to prepare for next iteration.
+      __m512i& _curr = extender._windows[extender.parity_bit];
+      __m512i& _next = extender._windows[extender.parity_bit ^= 0b1];
+      uint64_t& _last_seg_mask = extender._last_seg_masks[extender.parity_bit];
+      // Store the result in the extender segments, once we have saturated
+      // the windows. See the AVX2 implementation.
+      if (extender.steps >= kSaturationCount<C>)
+      {
+        const auto i = (extender.p + (kSegCount<C> - kSaturationCount<C>)) % kSegCount<C>;
+        extender.segments[i] = static_cast<uint8_t>(
+          _mm_cvtsi128_si32(_mm512_castsi512_si128(_next)));
+      }
+      // Shift the next segment one to the right, and insert the next segment
+      // as the last element of the window.
+      _right_shift<uint8_t>(_next, _next);
+      const auto next_length = extender.segments[extender.p];
+      static constexpr auto kLastElem = std::min(UINT32_C(63), kSaturationCount<C> / 2 - 1);
+      _next = _mm512_mask_set1_epi8(_next, UINT64_C(1) << kLastElem, next_length);
+
+      // Figure out if we are in the last segment.
+      __m512i& _counter = extender._counter;
+      _counter = _mm512_add_epi8(_counter, _curr);
+      __mmask64 _last_seg = _mm512_cmpeq_epi8_mask(_counter, _len_plus_one);
+
+      // Handle pushing case:
+
+      // Compute: PD = min(push_limit, C - 1), but only for the segments that
+      // are longer than 1. The remaining elements are zeroed by the mask.
+      const __m512i _curr_minus_one = _mm512_sub_epi8(_curr, _ones);
+      const __m512i _curr_push_limit =
+        _mm512_mask_blend_epi8(_last_seg, _push_limit, _last_push_limit);
+      const __mmask64 _greater_one = _mm512_cmpgt_epu8_mask(_curr, _ones);
+      const __m512i _push_delta =
+        _mm512_maskz_min_epu8(_greater_one, _curr_push_limit, _curr_minus_one);
+
+      // Handle pulling case:
+
+      // We pull everything from the next segment if we have length one, unless
+      // it is the last segment, in which case we have to pull nothing.
+      const __mmask64 _equal_one = _mm512_cmpeq_epi8_mask(_curr, _ones);
+      const __m512i _pull_delta = _mm512_maskz_mov_epi8(_equal_one & ~_last_seg, _next);
+
+      // Compute: D = _pull_delta - _push_delta
+      const __m512i _delta = _mm512_sub_epi8(_pull_delta, _push_delta);
+      _curr = _mm512_add_epi8(_curr, _delta);
+      _next = _mm512_sub_epi8(_next, _delta);
+
+      // Update the counter, and reset it if we are still at the last segment.
+      _counter = _mm512_add_epi8(_counter, _delta);
+      _last_seg = _mm512_cmpeq_epi8_mask(_counter, _len_plus_one);
+      _counter = _mm512_maskz_mov_epi8(~_last_seg, _counter);
+      _last_seg_mask = _last_seg;
+
+      _update_fingerprint(extender);
+      extender.p = (extender.p + 1) % kSegCount<C>;
+      extender.steps++;
+    }
+
+    static inline bool _finished(const Extender<C>& extender)
+    {
+      // See the AVX2 implementation for details.
+      assert(0 <= extender.p && extender.p <= kSaturationCount<C>);
+      uint32_t first_seg_index = (extender.p > 0) * (kSaturationCount<C> - extender.p) / 2;
+      const uint32_t parity = extender.parity_bit ^ (extender.p & 0x1);
+      return (extender._last_seg_masks[parity] >> first_seg_index) & 0x1;
+    }
+
+    static inline bool _equals(const Extender<C>& lhs, const Extender<C>& rhs)
+    {
+      // See the AVX2 implementation for details.
+      if (lhs.p != rhs.p)
+      {
+        return false;
+      }
+      for (uint32_t i = 0; i < 2; i++)
+      {
+        if (_mm512_cmpneq_epi8_mask(lhs._windows[i], rhs._windows[i]))
+        {
+          return false;
+        }
+      }
+      static constexpr size_t cnt = kSegCount<C> - kSaturationCount<C>;
+      if constexpr (cnt != 0)
+      {
+        assert(0 <= lhs.p && lhs.p <= kSaturationCount<C>);
+        const auto lhs_start = lhs.segments + lhs.p;
+        const auto rhs_start = rhs.segments + rhs.p;
+        return std::memcmp(lhs_start, rhs_start, cnt * sizeof(uint8_t)) == 0;
+      }
+      return true;
+    }
+  };
+
+  /* uint16_t implementation for AVX-512 */
+
+  template<>
+  inline void _right_shift<uint16_t>(const __m512i& _value, __m512i& _dst)
+  {
+    // See uint8_t version for implementation details.
+    const __m512i _tmp = _mm512_alignr_epi32(_mm512_setzero_si512(), _value, 4);
+    _dst = _mm512_alignr_epi8(_tmp, _value, sizeof(uint16_t));
+  }
+
+  template<typename C>
+  struct _Kernel<C, uint16_t>
+  {
+    static inline void _simulate_step(Extender<C>& extender)
+    {
+      // See uint8_t version for implementation details.
+      const __m512i _ones = _mm512_set1_epi16(1);
+
+      const __m512i _push_limit = _mm512_set1_epi16(C::kPushLimit);
+      const __m512i _last_push_limit = _mm512_set1_epi16(C::kLastPushLimit);
+      const __m512i _len_plus_one = _mm512_set1_epi16(C::kLength + 1);
+
+      __m512i& _curr = extender._windows[extender.parity_bit];
+      __m512i& _next = extender._windows[extender.parity_bit ^= 0b1];
+      uint64_t& _last_seg_mask = extender._last_seg_masks[extender.parity_bit];
+
+      if (extender.steps >= kSaturationCount<C>)
+      {
+        const auto i = (extender.p + (kSegCount<C> - kSaturationCount<C>)) % kSegCount<C>;
+        extender.segments[i] = static_cast<uint16_t>(
+          _mm_cvtsi128_si32(_mm512_castsi512_si128(_next)));
+      }
+
+      _right_shift<uint16_t>(_next, _next);
+      const auto next_length = extender.segments[extender.p];
+      static constexpr auto kLastElem = std::min(UINT32_C(31), kSaturationCount<C> / 2 - 1);
+      _next = _mm512_mask_set1_epi16(_next, UINT32_C(1) << kLastElem, next_length);
+
+      __m512i& _counter = extender._counter;
+      _counter = _mm512_add_epi16(_counter, _curr);
+      __mmask32 _last_seg = _mm512_cmpeq_epi16_mask(_counter, _len_plus_one);
+
+      // Handle pushing case:
+
+      const __m512i _curr_minus_one = _mm512_sub_epi16(_curr, _ones);
+      const __m512i _curr_push_limit =
+        _mm512_mask_blend_epi16(_last_seg, _push_limit, _last_push_limit);
+      const __mmask32 _greater_one = _mm512_cmpgt_epu16_mask(_curr, _ones);
+      const __m512i _push_delta =
+        _mm512_maskz_min_epu16(_greater_one, _curr_push_limit, _curr_minus_one);
+
+      // Handle pulling case:
+
+      const __mmask32 _equal_one = _mm512_cmpeq_epi16_mask(_curr, _ones);
+      const __m512i _pull_delta = _mm512_maskz_mov_epi16(_equal_one & ~_last_seg, _next);
+
+      const __m512i _delta = _mm512_sub_epi16(_pull_delta, _push_delta);
+      _curr = _mm512_add_epi16(_curr, _delta);
+      _next = _mm512_sub_epi16(_next, _delta);
+
+      _counter = _mm512_add_epi16(_counter, _delta);
+      _last_seg = _mm512_cmpeq_epi16_mask(_counter, _len_plus_one);
+      _counter = _mm512_maskz_mov_epi16(~_last_seg, _counter);
+      _last_seg_mask = _last_seg;
+
+      _update_fingerprint(extender);
+      extender.p = (extender.p + 1) % kSegCount<C>;
+      extender.steps++;
+    }
+
+    static inline bool _finished(const Extender<C>& extender)
+    {
+      // See uint8_t version for implementation details. Note that unlike
+      // AVX2, the masks contain a single bit per element, regardless of
+      // the size of the element.
+      assert(0 <= extender.p && extender.p <= kSaturationCount<C>);
+      uint32_t first_seg_index = (extender.p > 0) * (kSaturationCount<C> - extender.p) / 2;
+      const uint32_t parity = extender.parity_bit ^ (extender.p & 0x1);
+      return (extender._last_seg_masks[parity] >> first_seg_index) & 0x1;
+    }
+
+    static inline bool _equals(const Extender<C>& lhs, const Extender<C>& rhs)
+    {
+      // See uint8_t version for implementation details.
+      if (lhs.p != rhs.p)
+      {
+        return false;
+      }
+      for (uint32_t i = 0; i < 2; i++)
+      {
+        if (_mm512_cmpneq_epi16_mask(lhs._windows[i], rhs._windows[i]))
+        {
+          return false;
+        }
+      }
+      static constexpr size_t cnt = kSegCount<C> - kSaturationCount<C>;
+      if constexpr (cnt != 0)
+      {
+        assert(0 <= lhs.p && lhs.p <= kSaturationCount<C>);
+        const auto lhs_start = lhs.segments + lhs.p;
+        const auto rhs_start = rhs.segments + rhs.p;
+        return std::memcmp(lhs_start, rhs_start, cnt * sizeof(uint16_t)) == 0;
+      }
+      return true;
+    }
+  };
+
+  template<typename C>
+  inline Extender<C> create()
+  {
+    Extender<C> extender;
+    extender.segments = allocate<typename C::len_t>(kSegCount<C>);
+    for (uint32_t i = 0; i < kSegCount<C>; i++)
+    {
+      // Note: there are sometimes trailing segments with zeros.
+      extender.segments[i] = (i <= C::kLength) ? 1 : 0;
+    }
+    // Reset the two windows, and the parity bit:
+    for (uint32_t i = 0; i < 2; i++)
+    {
+      extender._windows[i] = _mm512_setzero_si512();
+      extender._last_seg_masks[i] = 0;
+    }
+    extender._counter = _mm512_setzero_si512();
+    extender.parity_bit = 0b0;
+    extender.keys = fingerprint_keys<kSegCount<C>>();
+    extender.fingerprint = 0;
+    for (uint32_t i = 0; i < kSegCount<C> - kSaturationCount<C>; i++)
+    {
+      extender.fingerprint += extender.segments[i] * extender.keys[i];
+    }
+    extender.p = 0;
+    extender.steps = 0;
+    return std::move(extender);
+  }
+
+  template<typename C>
+  inline void destroy(Extender<C>& extender)
+  {
+    deallocate(extender.segments, kSegCount<C>);
+    extender.segments = nullptr;
+  }
+
+  // Copies the state of the given extender into another extender, e.g. to
+  // take a snapshot of it. The registers are copied as they are, so the copy
+  // continues with the same phase.
+  template<typename C>
+  inline void copy(Extender<C>& dst, const Extender<C>& src)
+  {
+    typename C::len_t* segments = dst.segments;
+    dst = src;
+    dst.segments = segments;
+    std::memcpy(segments, src.segments, kSegCount<C> * sizeof(typename C::len_t));
+  }
+
+  // Writes the lengths of the kLength + 1 segments of the extender to the
+  // given array, see the AVX2 implementation. The windows are passed on in
+  // the order that the AVX2 implementation uses: first the window that was
+  // just simulated as the current window, then the next window.
+  template<typename C>
+  inline void read_segments(const Extender<C>& extender, typename C::len_t* dst)
+  {
+    typedef typename C::len_t len_t;
+    len_t windows[2][kElemCount<C>];
+    len_t counters[1][kElemCount<C>];
+    for (uint32_t i = 0; i < 2; i++)
+    {
+      _mm512_storeu_si512(windows[i], extender._windows[extender.parity_bit ^ i ^ 0b1]);
+    }
+    _mm512_storeu_si512(counters[0], extender._counter);
+    read_window_segments<C, kSegCount<C>, kSaturationCount<C>>(
+      extender.segments, extender.p, extender.steps, windows, counters, dst);
+  }
+
+  template<typename C>
+  inline void simulate_pulse(Extender<C>& extender)
+  {
+    // See the AVX2 implementation for details.
+    while (extender.p >= kSaturationCount<C>)
+    {
+      _Kernel<C>::_simulate_step(extender);
+    }
+    _Kernel<C>::_simulate_step(extender);
+    _Kernel<C>::_simulate_step(extender);
+  }
+
+  template<typename C>
+  inline bool equals(const Extender<C>& lhs, const Extender<C>& rhs)
+  {
+    // Only compare the segments if their fingerprints match.
+    return lhs.fingerprint == rhs.fingerprint && _Kernel<C>::_equals(lhs, rhs);
+  }
+
+  // Copies the windows as they are, rather than completing the pulses in
+  // them, see snaperz_fingerprint.h.
+  template<typename C>
+  inline void take_sample(const Extender<C>& extender, Sample& sample)
+  {
+    // Every sample of a loop check sees the same phase, see constants.h.
+    static_assert(LOOP_CHECK_INTERVAL % (kSaturationCount<C> / 2) == 0,
+                  "The phase of the windows must repeat between loop samples");
+    take_window_sample(extender.fingerprint, extender.p, extender._windows, sample);
+  }
+
+  template<typename C>
+  inline uint64_t fingerprint(const Extender<C>& extender)
+  {
+    Sample sample;
+    take_sample(extender, sample);
+    return sample_fingerprint(sample);
+  }
+
+  template<typename C>
+  inline bool finished(const Extender<C>& extender)
+  {
+    return _Kernel<C>::_finished(extender);
+  }
+} // namespace snaperz::avx512
+
+#pragma GCC pop_options
+#else // SNAPERZ_X86
+// There is a bug in snaperz_extender.h if this happens.
+#error "Requires an x86 target."
+#endif // !SNAPERZ_X86
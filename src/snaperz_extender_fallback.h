@@ -1,144 +1,166 @@
 #pragma once
 
+#include <cstring>
+
 #include "constants.h"
+#include "snaperz_memory.h"
+#include "snaperz_fingerprint.h"
 
-namespace snaperz
+namespace snaperz::fallback
 {
   // Paranoid sanity check; not a hard limitation. Just a slight
   // optimization over using bytes or similar for the block segments.
   // Very unlikely that this will fail anyway.
-  static_assert(std::numeric_limits<len_t>::max() <= std::numeric_limits<uint32_t>::max(),
-                "Extender length must fit into a 32-bit uint");
+  template<typename C>
+  static constexpr bool kSupported =
+    std::numeric_limits<typename C::len_t>::max() <= std::numeric_limits<uint32_t>::max();
 
-  struct BlockSegment
-  {
-    uint32_t len;
-    BlockSegment* next;
-  };
+  // Note: leave an extra segment after the last block. This segment is always
+  // zero, but allows us to look at the next segment without a bounds check.
+  template<typename C>
+  static constexpr uint32_t kSegCount = C::kLength + 2;
 
+  template<typename C>
   struct Extender
   {
-    BlockSegment* segments;
+    static_assert(kSupported<C>, "Extender length must fit into a 32-bit uint");
+
+    // The lengths of every segment, from back to front. Segments that are
+    // currently not present have length zero.
+    typename C::len_t* segments;
+    // The fingerprint of the segments, see snaperz_fingerprint.h.
+    uint64_t fingerprint;
   };
 
-  Extender create()
+  template<typename C>
+  inline Extender<C> create()
   {
-    // Note: leave an extra segment for the last block.
-    Extender extender;
-    extender.segments = new BlockSegment[kLength + 1];
-    for (uint32_t i = 0; i < kLength + 1; i++)
+    Extender<C> extender;
+    extender.segments = allocate<typename C::len_t>(kSegCount<C>);
+    extender.fingerprint = 0;
+    const uint64_t* keys = fingerprint_keys<kSegCount<C>>();
+    for (uint32_t i = 0; i < kSegCount<C>; i++)
     {
-      auto curr = extender.segments + i;
-      curr->len = 1;
-      // Extra check if we are the last segment.
-      curr->next = (i != kLength) ? curr + 1 : nullptr;
+      extender.segments[i] = (i <= C::kLength) ? 1 : 0;
+      extender.fingerprint += extender.segments[i] * keys[i];
     }
     return std::move(extender);
   }
 
-  void destroy(Extender& extender)
+  template<typename C>
+  inline void destroy(Extender<C>& extender)
   {
-    delete[] extender.segments;
+    deallocate(extender.segments, kSegCount<C>);
     extender.segments = nullptr;
   }
 
-  void simulate_pulse(Extender& extender)
+  // Copies the state of the given extender into another extender, e.g. to
+  // take a snapshot of it.
+  template<typename C>
+  inline void copy(Extender<C>& dst, const Extender<C>& src)
   {
-    auto curr = extender.segments;
-    while (true)
-    {
-      if (curr->len > 1)
-      {
-        // Handle pushing case:
-        //   This case is quite trivial, since we simulate the extender in
-        //   the direction of the push. Therefore, we only need to consider
-        //   how many pistons are pushed at the end of this segment, to form
-        //   a new segment (or merge with the next sequential segment). How
-        //   the pistons push into further small segments is then handled by
-        //   simulating the next sequential segment in the next iteration of
-        //   the loop.
+    std::memcpy(dst.segments, src.segments, kSegCount<C> * sizeof(typename C::len_t));
+    dst.fingerprint = src.fingerprint;
+  }
 
-        // Note: If we are at the last segment. Since the last block in this
-        //       segment is not a piston, the virtual push limit no longer
-        //       applies, and thus we push an extra block.
-        uint32_t push_limit = curr->next ? kPushLimit : kLastPushLimit;
-        uint32_t blocks_to_push = std::min(push_limit, curr->len - 1);
-        // The blocks should be moved to the next sequential segment.
-        auto seq_next = curr + 1;
-        if (seq_next->len == 0)
-        {
-          // Insert the segment into the linked list (since it was zero,
-          // and therefore not present previously).
-          seq_next->next = curr->next;
-          curr->next = seq_next;
-        }
-        // Actually perform the move
-        curr->len -= blocks_to_push;
-        seq_next->len += blocks_to_push;
-      }
-      else
-      {
-        // Handle pulling case:
-        //   This case is not as simple, since it requires some knowledge of
-        //   how the extender behaves. In particular, whenever a piston is
-        //   pulled, it will immediately pull the next piston in front of it.
-        //   This has the consequence of essentially merging the next segment
-        //   into the current segment.
-        if (curr->next == nullptr)
-        {
-          // The segment only consists of the last block,
-          // i.e. not a piston. Therefore, we can not pull
-          // anything.
-          break;
-        }
-        auto seq_next = curr + 1;
-        if (seq_next->len != 0)
-        {
-          // Completely merge the segment into the current segment.
-          curr->len += seq_next->len;
-          seq_next->len = 0;
-          // Remove the segment from the linked list.
-          curr->next = seq_next->next;
-          if (curr->next == nullptr)
-          {
-            // We merged with the last segment in the extender.
-            break;
-          }
-        }
-      }
-      // Go to next segment.
-      curr = curr->next;
-    }
+  // Writes the lengths of the kLength + 1 segments of the extender to the
+  // given array, which are simply the segments of this engine.
+  template<typename C>
+  inline void read_segments(const Extender<C>& extender, typename C::len_t* dst)
+  {
+    std::memcpy(dst, extender.segments, (C::kLength + 1) * sizeof(typename C::len_t));
   }
 
-  bool equals(const Extender& lhs, const Extender& rhs)
+  template<typename C>
+  inline void simulate_pulse(Extender<C>& extender)
   {
-    auto lhs_curr = lhs.segments;
-    auto rhs_curr = rhs.segments;
-    while (lhs_curr && rhs_curr)
+    // Every segment is handled in the same way, regardless of its length, by
+    // computing the number of blocks it keeps, and the number of blocks it
+    // leaves for the next segment. The cases are selected with masks rather
+    // than branches, since the lengths are essentially random, which makes
+    // any branch on them hard to predict.
+    //
+    // To figure out whether we are in the last segment, we keep track of the
+    // number of blocks in the remaining segments. The last segment is the one
+    // that contains all of them. Since this only happens once per pulse, it
+    // is handled separately below, outside of the critical path.
+    //
+    // The fingerprint is updated for every segment that is stored. The old
+    // length of a segment was loaded as the next segment of the previous one.
+    typedef typename C::len_t len_t;
+    len_t* segments = extender.segments;
+    const uint64_t* keys = fingerprint_keys<kSegCount<C>>();
+    uint64_t fingerprint = extender.fingerprint;
+    uint32_t curr = segments[0];
+    uint32_t old = curr;
+    uint32_t remaining = C::kLength + 1;
+    uint32_t i = 0;
+    while (curr != remaining)
+    {
+      const uint32_t next = segments[i + 1];
+      // Handle pushing case:
+      //   Push at most kPushLimit blocks, but always leave the first piston
+      //   of the segment behind. Segments of length zero and one push
+      //   nothing, since the saturated curr - 1 is zero.
+      const uint32_t push_delta = std::min(C::kPushLimit, curr - (curr != 0));
+      // Handle pulling case:
+      //   A segment consisting of a single piston pulls the next segment,
+      //   completely merging it into the current segment. Note that a single
+      //   piston never pushes, so the two cases never overlap.
+      const uint32_t single_mask = -static_cast<uint32_t>(curr == 1);
+      const uint32_t stay = curr - push_delta + (next & single_mask);
+      segments[i] = static_cast<len_t>(stay);
+      fingerprint += (static_cast<uint64_t>(stay) - old) * keys[i];
+      old = next;
+      remaining -= stay;
+      // The next segment is only stored in the next iteration.
+      curr = (next + push_delta) & ~single_mask;
+      i++;
+    }
+    // Handle the last segment:
+    //   The last block is not a piston. Therefore, the virtual push limit no
+    //   longer applies, and we push an extra block. The blocks are pushed into
+    //   an empty segment, which then becomes the last segment. A last segment
+    //   of length one can not pull anything, since it is the last block.
+    while (curr > 1)
     {
-      // Check if the segment length is the same
-      if (lhs_curr->len != rhs_curr->len)
-      {
-        return false;
-      }
-      // Check if the relative indices are the same
-      if ((lhs_curr - lhs.segments) != (rhs_curr - rhs.segments))
-      {
-        return false;
-      }
-      // Go to next segment
-      lhs_curr = lhs_curr->next;
-      rhs_curr = rhs_curr->next;
+      const uint32_t push_delta = std::min(C::kLastPushLimit, curr - 1);
+      fingerprint += (static_cast<uint64_t>(curr - push_delta) - old) * keys[i];
+      segments[i++] = static_cast<len_t>(curr - push_delta);
+      old = segments[i];
+      curr = push_delta;
     }
-    // Check if they are both equal (i.e. nullptr).
-    return (lhs_curr == rhs_curr);
+    fingerprint += (static_cast<uint64_t>(curr) - old) * keys[i];
+    segments[i] = static_cast<len_t>(curr);
+    extender.fingerprint = fingerprint;
+  }
+
+  template<typename C>
+  inline bool equals(const Extender<C>& lhs, const Extender<C>& rhs)
+  {
+    return lhs.fingerprint == rhs.fingerprint &&
+           std::memcmp(lhs.segments, rhs.segments, kSegCount<C> * sizeof(typename C::len_t)) == 0;
+  }
+
+  template<typename C>
+  inline uint64_t fingerprint(const Extender<C>& extender)
+  {
+    return extender.fingerprint;
+  }
+
+  // The fingerprint is the only state in the sample, see
+  // snaperz_fingerprint.h.
+  template<typename C>
+  inline void take_sample(const Extender<C>& extender, Sample& sample)
+  {
+    sample.fingerprint = fingerprint(extender);
+    sample.word_count = 0;
   }
 
-  bool finished(const Extender& extender)
+  template<typename C>
+  inline bool finished(const Extender<C>& extender)
   {
-    // Check if extender itself is the last segment, i.e. that
-    // every block is in the first segment.
-    return extender.segments->next == nullptr;
+    // Check if every block is in the first segment.
+    return extender.segments[0] == C::kLength + 1;
   }
-}
+} // namespace snaperz::fallback
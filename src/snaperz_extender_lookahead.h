@@ -0,0 +1,365 @@
+#pragma once
+
+#if SNAPERZ_X86
+// This implementation evaluates a pulse as a parallel prefix over the carries
+// between the segments, similar to a carry-lookahead adder.
+//
+// Within a pulse, the action of a segment only depends on its own length, and
+// on the carry of the previous segment, i.e. the number of blocks that the
+// previous segment pushed into it, or whether it was pulled by the previous
+// segment. Whether a segment is the last segment, and therefore unable to
+// pull, only depends on its position. Every segment therefore maps the
+// incoming carry to an outgoing carry, and there are only a few different
+// carries (at most kLastPushLimit + 2).
+//
+// The segments are split into chunks, which are simulated in the lanes of
+// the AVX2 registers. Every pulse then consists of three phases:
+//   1. Compose the mappings of the segments of every chunk, by simulating the
+//      chunk for every possible incoming carry at the same time.
+//   2. Compute the actual carry into every chunk, using the composed mappings.
+//   3. Simulate every chunk using its actual incoming carry.
+// The first and last phases are independent across the chunks, and only the
+// second phase has to pass through the chunks one by one.
+//
+// Note: the first phase simulates every segment once for every carry, so this
+//       is only faster than the fallback implementation for extenders of
+//       about 150 pistons or more, and for short periods. It is never faster
+//       than the AVX2 implementation, which is why it is never selected
+//       automatically.
+#include <immintrin.h>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+
+#include "constants.h"
+#include "snaperz_memory.h"
+#include "snaperz_fingerprint.h"
+
+// Compile this engine for AVX2 regardless of the flags used for the rest
+// of the program. The engine is only selected if the CPU supports it, see
+// snaperz_extender.h.
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+namespace snaperz::lookahead
+{
+  // The segments are always stored as 32-bit lanes.
+  template<typename C>
+  static constexpr bool kSupported =
+    std::numeric_limits<typename C::len_t>::max() <= std::numeric_limits<uint32_t>::max();
+
+  // The carry of a segment that pulls the next segment. Other carries are the
+  // number of blocks pushed into the next segment.
+  template<typename C>
+  static constexpr uint32_t kPull = C::kLastPushLimit + 1;
+  template<typename C>
+  static constexpr uint32_t kCarryCount = kPull<C> + 1;
+  // The last segment can push blocks at most this many segments further.
+  template<typename C>
+  static constexpr uint32_t kCascadeLength = C::kLastPushLimit + 1;
+
+  // The segments are grouped into blocks of chunks, where every chunk is
+  // simulated in its own lane of the registers. Every row of a block consists
+  // of several registers, which gives the CPU independent work while it waits
+  // for the carries of the previous row.
+  static constexpr uint32_t kLaneCount = sizeof(__m256i) / sizeof(uint32_t);
+  static constexpr uint32_t kVectorCount = 4;
+  static constexpr uint32_t kBlockWidth = kVectorCount * kLaneCount;
+  // Every pulse simulates whole blocks, so the chunks are only as long as a
+  // single block needs to hold the extender, up to 64 segments. Longer
+  // extenders use several blocks.
+  template<typename C>
+  static constexpr uint32_t kChunkLength =
+    std::min<uint32_t>((C::kLength + kCascadeLength<C>) / kBlockWidth + 1, 64);
+  template<typename C>
+  static constexpr uint32_t kBlockLength = kBlockWidth * kChunkLength<C>;
+  template<typename C>
+  static constexpr uint32_t kBlockCount = (C::kLength + 1 + kCascadeLength<C>) / kBlockLength<C> + 1;
+  // Note: leave an extra block after the last block. This block is always
+  // zero, but allows us to look at the next segment without a bounds check.
+  template<typename C>
+  static constexpr uint32_t kSegCount = (kBlockCount<C> + 1) * kBlockLength<C>;
+
+  template<typename C>
+  struct Extender
+  {
+    // The lengths of every segment, one block after the other. Within a block,
+    // the j-th row contains the j-th segment of every chunk.
+    uint32_t* segments;
+    // The composed mappings of the chunks in every block, i.e. the carries
+    // out of every chunk, for each of the carries into the chunks.
+    __m256i* mappings;
+    // The carries into the chunks of every block.
+    __m256i* carries;
+    // The index of the last segment, i.e. the last segment that is not empty.
+    uint32_t last;
+  };
+
+  template<typename C>
+  inline size_t _address(uint32_t i)
+  {
+    const size_t block = i / kBlockLength<C>;
+    const size_t chunk = i % kBlockLength<C> / kChunkLength<C>;
+    const size_t row = i % kChunkLength<C>;
+    return (block * kChunkLength<C> + row) * kBlockWidth + chunk;
+  }
+
+  template<typename C>
+  inline void _compute_last_seg_masks(uint32_t block, uint32_t row, uint32_t last, __m256i* _last_seg_masks)
+  {
+    // The index of the segment in every lane of the first register of the row.
+    const __m256i _lane_offsets = _mm256_set_epi32(
+      7 * kChunkLength<C>, 6 * kChunkLength<C>, 5 * kChunkLength<C>, 4 * kChunkLength<C>,
+      3 * kChunkLength<C>, 2 * kChunkLength<C>, 1 * kChunkLength<C>, 0 * kChunkLength<C>
+    );
+    __m256i _index = _mm256_add_epi32(
+      _lane_offsets, _mm256_set1_epi32(static_cast<int>(block * kBlockLength<C> + row)));
+    // Compute: index >= last <==> index > last - 1. The indices are far below
+    // 2^31, so the signed comparison is fine.
+    const __m256i _last_minus_one = _mm256_set1_epi32(static_cast<int>(last) - 1);
+    for (uint32_t v = 0; v < kVectorCount; v++)
+    {
+      _last_seg_masks[v] = _mm256_cmpgt_epi32(_index, _last_minus_one);
+      _index = _mm256_add_epi32(_index, _mm256_set1_epi32(kLaneCount * kChunkLength<C>));
+    }
+  }
+
+  template<typename C>
+  inline __m256i _simulate_carry(const __m256i& _length, const __m256i& _carry, const __m256i& _last_seg_mask)
+  {
+    const __m256i _ones = _mm256_set1_epi32(1);
+    const __m256i _pull = _mm256_set1_epi32(kPull<C>);
+    // The virtual push limit no longer applies to the last segment.
+    const __m256i _push_limit = _mm256_blendv_epi8(
+      _mm256_set1_epi32(C::kPushLimit), _mm256_set1_epi32(C::kLastPushLimit), _last_seg_mask);
+
+    __m256i _curr = _mm256_add_epi32(_length, _carry);
+    // Compute: PD = min(push_limit, max(C, 1) - 1), i.e. push at most the push
+    // limit, but always leave the first piston of the segment behind.
+    __m256i _push_delta = _mm256_sub_epi32(_mm256_max_epu32(_curr, _ones), _ones);
+    _push_delta = _mm256_min_epu32(_push_delta, _push_limit);
+    // A single piston pulls the next segment, unless it is the last segment.
+    __m256i _pull_mask = _mm256_andnot_si256(_last_seg_mask, _mm256_cmpeq_epi32(_curr, _ones));
+    __m256i _carry_out = _mm256_blendv_epi8(_push_delta, _pull, _pull_mask);
+    // A segment that was pulled is empty, and carries nothing.
+    __m256i _pulled_mask = _mm256_cmpeq_epi32(_carry, _pull);
+    return _mm256_andnot_si256(_pulled_mask, _carry_out);
+  }
+
+  template<typename C>
+  inline void _compose_block(Extender<C>& extender, uint32_t block)
+  {
+    const __m256i* rows = reinterpret_cast<const __m256i*>(
+      extender.segments + static_cast<size_t>(block) * kBlockLength<C>);
+    // Start with the identity mapping.
+    __m256i _mappings[kCarryCount<C>][kVectorCount];
+    for (uint32_t c = 0; c < kCarryCount<C>; c++)
+    {
+      for (uint32_t v = 0; v < kVectorCount; v++)
+      {
+        _mappings[c][v] = _mm256_set1_epi32(c);
+      }
+    }
+    for (uint32_t row = 0; row < kChunkLength<C>; row++)
+    {
+      __m256i _last_seg_masks[kVectorCount];
+      _compute_last_seg_masks<C>(block, row, extender.last, _last_seg_masks);
+      for (uint32_t v = 0; v < kVectorCount; v++)
+      {
+        const __m256i _length = _mm256_load_si256(rows + row * kVectorCount + v);
+        for (uint32_t c = 0; c < kCarryCount<C>; c++)
+        {
+          _mappings[c][v] = _simulate_carry<C>(_length, _mappings[c][v], _last_seg_masks[v]);
+        }
+      }
+    }
+    __m256i* mappings = extender.mappings + block * kCarryCount<C> * kVectorCount;
+    for (uint32_t c = 0; c < kCarryCount<C>; c++)
+    {
+      for (uint32_t v = 0; v < kVectorCount; v++)
+      {
+        mappings[c * kVectorCount + v] = _mappings[c][v];
+      }
+    }
+  }
+
+  template<typename C>
+  inline void _simulate_block(Extender<C>& extender, uint32_t block)
+  {
+    uint32_t* segments = extender.segments + static_cast<size_t>(block) * kBlockLength<C>;
+    __m256i* rows = reinterpret_cast<__m256i*>(segments);
+    const __m256i _ones = _mm256_set1_epi32(1);
+    const __m256i _pull = _mm256_set1_epi32(kPull<C>);
+    // The segment after the last row of every chunk is the first segment of
+    // the next chunk, which is overwritten before we get there. Therefore,
+    // copy the first row up front, including the first segment of the next
+    // block, such that it can be loaded shifted by one lane.
+    alignas(__m256i) uint32_t firsts[kBlockWidth + kLaneCount];
+    std::memcpy(firsts, segments, kBlockWidth * sizeof(uint32_t));
+    firsts[kBlockWidth] = segments[kBlockLength<C>];
+
+    __m256i _carries[kVectorCount];
+    for (uint32_t v = 0; v < kVectorCount; v++)
+    {
+      _carries[v] = extender.carries[block * kVectorCount + v];
+    }
+    for (uint32_t row = 0; row < kChunkLength<C>; row++)
+    {
+      __m256i _last_seg_masks[kVectorCount];
+      _compute_last_seg_masks<C>(block, row, extender.last, _last_seg_masks);
+      for (uint32_t v = 0; v < kVectorCount; v++)
+      {
+        __m256i* _row = rows + row * kVectorCount + v;
+        const __m256i _length = _mm256_load_si256(_row);
+        const __m256i _next = (row + 1 < kChunkLength<C>)
+          ? _mm256_load_si256(_row + kVectorCount)
+          : _mm256_loadu_si256(reinterpret_cast<const __m256i*>(firsts + v * kLaneCount + 1));
+        const __m256i _carry = _carries[v];
+        const __m256i _carry_out = _simulate_carry<C>(_length, _carry, _last_seg_masks[v]);
+        // A segment that pushes keeps its blocks, except for the ones it pushes.
+        // A segment that pulls keeps its piston, and all of the next segment.
+        // A segment that was pulled keeps nothing.
+        __m256i _stay = _mm256_sub_epi32(_mm256_add_epi32(_length, _carry), _carry_out);
+        const __m256i _pulling_mask = _mm256_cmpeq_epi32(_carry_out, _pull);
+        _stay = _mm256_blendv_epi8(_stay, _mm256_add_epi32(_next, _ones), _pulling_mask);
+        const __m256i _pulled_mask = _mm256_cmpeq_epi32(_carry, _pull);
+        _mm256_store_si256(_row, _mm256_andnot_si256(_pulled_mask, _stay));
+        _carries[v] = _carry_out;
+      }
+    }
+  }
+
+  template<typename C>
+  inline Extender<C> create()
+  {
+    Extender<C> extender;
+    extender.segments = allocate<uint32_t>(kSegCount<C>);
+    for (uint32_t i = 0; i < kSegCount<C>; i++)
+    {
+      extender.segments[_address<C>(i)] = (i <= C::kLength) ? 1 : 0;
+    }
+    extender.mappings = allocate<__m256i>(kBlockCount<C> * kCarryCount<C> * kVectorCount);
+    extender.carries = allocate<__m256i>(kBlockCount<C> * kVectorCount);
+    extender.last = C::kLength;
+    return std::move(extender);
+  }
+
+  template<typename C>
+  inline void destroy(Extender<C>& extender)
+  {
+    deallocate(extender.segments, kSegCount<C>);
+    deallocate(extender.mappings, kBlockCount<C> * kCarryCount<C> * kVectorCount);
+    deallocate(extender.carries, kBlockCount<C> * kVectorCount);
+    extender.segments = nullptr;
+    extender.mappings = nullptr;
+    extender.carries = nullptr;
+  }
+
+  // Copies the state of the given extender into another extender, e.g. to
+  // take a snapshot of it. The mappings and carries are only used during a
+  // pulse.
+  template<typename C>
+  inline void copy(Extender<C>& dst, const Extender<C>& src)
+  {
+    std::memcpy(dst.segments, src.segments, kSegCount<C> * sizeof(uint32_t));
+    dst.last = src.last;
+  }
+
+  // Writes the lengths of the kLength + 1 segments of the extender to the
+  // given array, in order rather than by block.
+  template<typename C>
+  inline void read_segments(const Extender<C>& extender, typename C::len_t* dst)
+  {
+    for (uint32_t i = 0; i <= C::kLength; i++)
+    {
+      dst[i] = static_cast<typename C::len_t>(extender.segments[_address<C>(i)]);
+    }
+  }
+
+  template<typename C>
+  inline void simulate_pulse(Extender<C>& extender)
+  {
+    // Only simulate the blocks that the pulse is able to reach.
+    const uint32_t end = extender.last + kCascadeLength<C>;
+    const uint32_t block_count = end / kBlockLength<C> + 1;
+    assert(block_count <= kBlockCount<C>);
+
+    // (1) Compose the mappings of every chunk.
+    for (uint32_t block = 0; block < block_count; block++)
+    {
+      _compose_block(extender, block);
+    }
+    // (2) Compute the carry into every chunk. The pulse starts without any
+    // carry into the first segment.
+    uint32_t carry = 0;
+    for (uint32_t block = 0; block < block_count; block++)
+    {
+      const auto mappings = reinterpret_cast<const uint32_t*>(
+        extender.mappings + block * kCarryCount<C> * kVectorCount);
+      auto carries = reinterpret_cast<uint32_t*>(extender.carries + block * kVectorCount);
+      for (uint32_t chunk = 0; chunk < kBlockWidth; chunk++)
+      {
+        carries[chunk] = carry;
+        carry = mappings[carry * kBlockWidth + chunk];
+      }
+    }
+    // (3) Simulate every chunk.
+    for (uint32_t block = 0; block < block_count; block++)
+    {
+      _simulate_block(extender, block);
+    }
+
+    // The last segment is either pulled by the previous segment, or it pushes
+    // blocks into at most kCascadeLength segments.
+    uint32_t last = end;
+    while (last > 0 && extender.segments[_address<C>(last)] == 0)
+    {
+      last--;
+    }
+    extender.last = last;
+  }
+
+  template<typename C>
+  inline bool equals(const Extender<C>& lhs, const Extender<C>& rhs)
+  {
+    return std::memcmp(lhs.segments, rhs.segments, kSegCount<C> * sizeof(uint32_t)) == 0;
+  }
+
+  template<typename C>
+  inline uint64_t fingerprint(const Extender<C>& extender)
+  {
+    // Every pulse rewrites whole blocks of segments, so keeping the
+    // fingerprint up to date would cost as much as computing it here.
+    // Note: the segments are keyed by their index rather than by their
+    //       address, like the segments of the other engines.
+    const uint64_t* keys = fingerprint_keys<C::kLength + 1>();
+    uint64_t fingerprint = 0;
+    for (uint32_t i = 0; i <= C::kLength; i++)
+    {
+      fingerprint += extender.segments[_address<C>(i)] * keys[i];
+    }
+    return fingerprint;
+  }
+
+  // The fingerprint is the only state in the sample, see
+  // snaperz_fingerprint.h.
+  template<typename C>
+  inline void take_sample(const Extender<C>& extender, Sample& sample)
+  {
+    sample.fingerprint = fingerprint(extender);
+    sample.word_count = 0;
+  }
+
+  template<typename C>
+  inline bool finished(const Extender<C>& extender)
+  {
+    // Check if every block is in the first segment.
+    return extender.segments[0] == C::kLength + 1;
+  }
+} // namespace snaperz::lookahead
+
+#pragma GCC pop_options
+#else // SNAPERZ_X86
+// There is a bug in snaperz_extender.h if this happens.
+#error "Requires an x86 target."
+#endif // !SNAPERZ_X86
@@ -0,0 +1,457 @@
+#pragma once
+
+#if SNAPERZ_X86
+// This implementation mirrors the AVX2 implementation in snaperz_extender_avx2.h
+// closely, but operates on 128-bit windows. Refer to that file for a detailed
+// description of the algorithm. Since the windows consist of a single 128-bit
+// lane, no elements have to be restored after shifting the windows.
+#include <immintrin.h>
+#include <type_traits>
+#include <cstring>
+#include <cassert>
+
+#include "constants.h"
+#include "snaperz_memory.h"
+#include "snaperz_fingerprint.h"
+#include "snaperz_windows.h"
+
+// Compile this engine for SSE4.1 regardless of the flags used for the rest
+// of the program. The engine is only selected at runtime if the CPU supports
+// it, see snaperz_extender.h.
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+
+namespace snaperz::sse41
+{
+  // Hard limitation, since we only have implementations for <=16-bit elements.
+  // Longer extenders are simulated by one of the other engines instead.
+  template<typename C>
+  static constexpr bool kSupported =
+    std::numeric_limits<typename C::len_t>::max() <= std::numeric_limits<uint16_t>::max();
+
+  template<typename C>
+  static constexpr uint32_t kElemCount = sizeof(__m128i) / sizeof(typename C::len_t);
+  // Extenders that fit in the windows are padded with zero segments to fill
+  // them, like the resident extenders of the AVX2 implementation. The phase
+  // of the windows then repeats every kSaturationCount / 2 pulses, see
+  // fingerprint().
+  template<typename C>
+  static constexpr uint32_t kSegCount =
+    (C::kLength + 1 > 2 * kElemCount<C>) ? C::kLength + 1 : 2 * kElemCount<C>;
+  template<typename C>
+  static constexpr uint32_t kSaturationCount =
+    std::min(kSegCount<C>, 2 * kElemCount<C>);
+
+  template<typename C>
+  struct Extender
+  {
+    typename C::len_t* segments;
+    // The odd and even active windows of the segments that are currently
+    // being simulated.
+    __m128i _windows[2];
+    // Counters keeping track of how many blocks we have seen at that index
+    // of the window. This is used to check if we are in the last segment.
+    __m128i _counter;
+    // A cached value of the _last_seg_mask values used during simulation of
+    // each step. This is use to check if the extender has finished.
+    __m128i _last_seg_masks[2];
+    // The parity bit defining which window is active
+    uint32_t parity_bit;
+    // The position of the sequence which is first in the active window.
+    size_t p;
+    // The total number of steps that have been simulated.
+    uint64_t steps;
+    // The fingerprint of the segments outside of the windows, which is
+    // compared by equals() before the segments, see snaperz_fingerprint.h.
+    uint64_t fingerprint;
+    // The keys of the fingerprint.
+    const uint64_t* keys;
+  };
+
+  // Moves the fingerprint along with the segments outside of the windows,
+  // which start at p. Every step, the segment at p enters the windows, and
+  // the segment that was just stored leaves them.
+  template<typename C>
+  inline void _update_fingerprint(Extender<C>& extender)
+  {
+    static constexpr uint32_t cnt = kSegCount<C> - kSaturationCount<C>;
+    if constexpr (cnt != 0)
+    {
+      const auto i = (extender.p + cnt) % kSegCount<C>;
+      extender.fingerprint += extender.segments[i] * extender.keys[i] -
+                              extender.segments[extender.p] * extender.keys[extender.p];
+    }
+  }
+
+  template<typename T>
+  void _right_shift(const __m128i& _value, __m128i& _dst);
+
+  // The parts of the implementation that depend on both the extender and
+  // the element type. These are specialized for every element type below.
+  template<typename C, typename T = typename C::len_t>
+  struct _Kernel;
+
+#if _DEBUG
+  template<class T>
+  inline void _DEBUG_log(const __m128i & value)
+  {
+    const size_t n = sizeof(__m128i) / sizeof(T);
+    T buffer[n];
+    _mm_storeu_si128((__m128i*)buffer, value);
+    for (uint32_t i = n; i-- != 0; )
+    {
+      std::cout << +buffer[i] << " ";
+    }
+    std::cout << std::endl;
+  }
+#endif
+
+  /* uint8_t implementation for SSE4.1 */
+
+  template<>
+  inline void _right_shift<uint8_t>(const __m128i& _value, __m128i& _dst)
+  {
+    // Shift the value right by 1 byte, i.e. compute:
+    //   V'[i] = V[i + 1], forall n > i > 0
+    //   V'[n - 1] = 0
+    //
+    // Unlike AVX2, the byte shift operates on the entire window, so there is
+    // no element that has to be restored from the other 128-bit lane.
+    _dst = _mm_srli_si128(_value, 1);
+  }
+
+  template<typename C>
+  struct _Kernel<C, uint8_t>
+  {
+    static inline void _simulate_step(Extender<C>& extender)
+    {
+      // Constants
+      const __m128i _zeros = _mm_setzero_si128();
+      const __m128i _ones = _mm_set1_epi8(1);
+
+      const __m128i _push_limit = _mm_set1_epi8(C::kPushLimit);
+      const __m128i _last_push_limit = _mm_set1_epi8(C::kLastPushLimit);
+      const __m128i _len_plus_one = _mm_set1_epi8(C::kLength + 1);
+
+      // Compute reference to current (C) and next (N) segment(s). Also flip
+      // the parity bit to prepare for next iteration.
+      __m128i& _curr = extender._windows[extender.parity_bit];
+      __m128i& _next = extender._windows[extender.parity_bit ^= 0b1];
+      __m128i& _last_seg_mask = extender._last_seg_masks[extender.parity_bit];
+      // Store the result in the extender segments, once we have saturated
+      // the windows. See the AVX2 implementation.
+      if (extender.steps >= kSaturationCount<C>)
+      {
+        const auto i = (extender.p + (kSegCount<C> - kSaturationCount<C>)) % kSegCount<C>;
+        extender.segments[i] = static_cast<uint8_t>(_mm_cvtsi128_si32(_next));
+      }
+      // Shift the next segment one to the right, and insert the next segment
+      // as the last element of the window.
+      _right_shift<uint8_t>(_next, _next);
+      const auto next_length = extender.segments[extender.p];
+      static constexpr auto kLastElem = std::min(UINT32_C(15), kSaturationCount<C> / 2 - 1);
+      _next = _mm_insert_epi8(_next, next_length, kLastElem);
+
+      // Figure out if we are in the last segment.
+      __m128i& _counter = extender._counter;
+      _counter = _mm_add_epi8(_counter, _curr);
+      _last_seg_mask = _mm_cmpeq_epi8(_counter, _len_plus_one);
+
+      // Handle pushing case:
+
+      // Compute: PD = min(push_limit, C - 1), masked out for segments of
+      // length zero and one.
+      __m128i _curr_minus_one = _mm_sub_epi8(_curr, _ones);
+      __m128i _curr_push_limit = _mm_blendv_epi8(_push_limit, _last_push_limit, _last_seg_mask);
+      __m128i _push_delta = _mm_min_epu8(_curr_push_limit, _curr_minus_one);
+
+      __m128i _equal_one_mask = _mm_cmpeq_epi8(_curr, _ones);
+      _push_delta = _mm_andnot_si128(_equal_one_mask, _push_delta);
+      __m128i _equal_zero_mask = _mm_cmpeq_epi8(_curr, _zeros);
+      _push_delta = _mm_andnot_si128(_equal_zero_mask, _push_delta);
+
+      // Handle pulling case:
+
+      // We pull everything from the next segment if we have length one, unless
+      // it is the last segment, in which case we have to pull nothing.
+      __m128i _pull_delta = _mm_andnot_si128(_last_seg_mask, _next);
+      _pull_delta = _mm_and_si128(_equal_one_mask, _pull_delta);
+
+      // Compute: D = _pull_delta - _push_delta
+      __m128i _delta = _mm_sub_epi8(_pull_delta, _push_delta);
+      _curr = _mm_add_epi8(_curr, _delta);
+      _next = _mm_sub_epi8(_next, _delta);
+
+      // Update the counter, and reset it if we are still at the last segment.
+      _counter = _mm_add_epi8(_counter, _delta);
+      _last_seg_mask = _mm_cmpeq_epi8(_counter, _len_plus_one);
+      _counter = _mm_andnot_si128(_last_seg_mask, _counter);
+
+      _update_fingerprint(extender);
+      extender.p = (extender.p + 1) % kSegCount<C>;
+      extender.steps++;
+    }
+
+    static inline bool _finished(const Extender<C>& extender)
+    {
+      // See the AVX2 implementation for details.
+      assert(0 <= extender.p && extender.p <= kSaturationCount<C>);
+      uint32_t first_seg_index = (extender.p > 0) * (kSaturationCount<C> - extender.p) / 2;
+      const uint32_t parity = extender.parity_bit ^ (extender.p & 0x1);
+      const __m128i& _last_seg_mask = extender._last_seg_masks[parity];
+      return _mm_movemask_epi8(_last_seg_mask) & (1 << first_seg_index);
+    }
+
+    static inline bool _equals(const Extender<C>& lhs, const Extender<C>& rhs)
+    {
+      // See the AVX2 implementation for details.
+      if (lhs.p != rhs.p)
+      {
+        return false;
+      }
+      for (uint32_t i = 0; i < 2; i++)
+      {
+        __m128i _window_equal = _mm_cmpeq_epi8(lhs._windows[i], rhs._windows[i]);
+        if (_mm_movemask_epi8(_window_equal) != 0xFFFF)
+        {
+          return false;
+        }
+      }
+      static constexpr size_t cnt = kSegCount<C> - kSaturationCount<C>;
+      if constexpr (cnt != 0)
+      {
+        assert(0 <= lhs.p && lhs.p <= kSaturationCount<C>);
+        const auto lhs_start = lhs.segments + lhs.p;
+        const auto rhs_start = rhs.segments + rhs.p;
+        return std::memcmp(lhs_start, rhs_start, cnt * sizeof(uint8_t)) == 0;
+      }
+      return true;
+    }
+  };
+
+  /* uint16_t implementation for SSE4.1 */
+
+  template<>
+  inline void _right_shift<uint16_t>(const __m128i& _value, __m128i& _dst)
+  {
+    // See uint8_t version for implementation details.
+    _dst = _mm_srli_si128(_value, sizeof(uint16_t));
+  }
+
+  template<typename C>
+  struct _Kernel<C, uint16_t>
+  {
+    static inline void _simulate_step(Extender<C>& extender)
+    {
+      // See uint8_t version for implementation details.
+      const __m128i _zeros = _mm_setzero_si128();
+      const __m128i _ones = _mm_set1_epi16(1);
+
+      const __m128i _push_limit = _mm_set1_epi16(C::kPushLimit);
+      const __m128i _last_push_limit = _mm_set1_epi16(C::kLastPushLimit);
+      const __m128i _len_plus_one = _mm_set1_epi16(C::kLength + 1);
+
+      __m128i& _curr = extender._windows[extender.parity_bit];
+      __m128i& _next = extender._windows[extender.parity_bit ^= 0b1];
+      __m128i& _last_seg_mask = extender._last_seg_masks[extender.parity_bit];
+
+      if (extender.steps >= kSaturationCount<C>)
+      {
+        const auto i = (extender.p + (kSegCount<C> - kSaturationCount<C>)) % kSegCount<C>;
+        extender.segments[i] = static_cast<uint16_t>(_mm_cvtsi128_si32(_next));
+      }
+
+      _right_shift<uint16_t>(_next, _next);
+
+      const auto next_length = extender.segments[extender.p];
+      static constexpr auto kLastElem = std::min(UINT32_C(7), kSaturationCount<C> / 2 - 1);
+      _next = _mm_insert_epi16(_next, next_length, kLastElem);
+
+      __m128i& _counter = extender._counter;
+      _counter = _mm_add_epi16(_counter, _curr);
+      _last_seg_mask = _mm_cmpeq_epi16(_counter, _len_plus_one);
+
+      // Handle pushing case:
+
+      __m128i _curr_minus_one = _mm_sub_epi16(_curr, _ones);
+      __m128i _curr_push_limit = _mm_blendv_epi8(_push_limit, _last_push_limit, _last_seg_mask);
+      __m128i _push_delta = _mm_min_epu16(_curr_push_limit, _curr_minus_one);
+
+      __m128i _equal_one_mask = _mm_cmpeq_epi16(_curr, _ones);
+      _push_delta = _mm_andnot_si128(_equal_one_mask, _push_delta);
+      __m128i _equal_zero_mask = _mm_cmpeq_epi16(_curr, _zeros);
+      _push_delta = _mm_andnot_si128(_equal_zero_mask, _push_delta);
+
+      // Handle pulling case:
+
+      __m128i _pull_delta = _mm_andnot_si128(_last_seg_mask, _next);
+      _pull_delta = _mm_and_si128(_equal_one_mask, _pull_delta);
+
+      __m128i _delta = _mm_sub_epi16(_pull_delta, _push_delta);
+      _curr = _mm_add_epi16(_curr, _delta);
+      _next = _mm_sub_epi16(_next, _delta);
+
+      _counter = _mm_add_epi16(_counter, _delta);
+      _last_seg_mask = _mm_cmpeq_epi16(_counter, _len_plus_one);
+      _counter = _mm_andnot_si128(_last_seg_mask, _counter);
+
+      _update_fingerprint(extender);
+      extender.p = (extender.p + 1) % kSegCount<C>;
+      extender.steps++;
+    }
+
+    static inline bool _finished(const Extender<C>& extender)
+    {
+      // See uint8_t version for implementation details.
+      assert(0 <= extender.p && extender.p <= kSaturationCount<C>);
+      uint32_t first_seg_index = (extender.p > 0) * (kSaturationCount<C> - extender.p) / 2;
+      const uint32_t parity = extender.parity_bit ^ (extender.p & 0x1);
+      const __m128i& _last_seg_mask = extender._last_seg_masks[parity];
+      // Note: should be shifted twice as far over due to 16-bit versus 8-bit.
+      return _mm_movemask_epi8(_last_seg_mask) & (1 << (2 * first_seg_index));
+    }
+
+    static inline bool _equals(const Extender<C>& lhs, const Extender<C>& rhs)
+    {
+      // See uint8_t version for implementation details.
+      if (lhs.p != rhs.p)
+      {
+        return false;
+      }
+      for (uint32_t i = 0; i < 2; i++)
+      {
+        __m128i _window_equal = _mm_cmpeq_epi16(lhs._windows[i], rhs._windows[i]);
+        if (_mm_movemask_epi8(_window_equal) != 0xFFFF)
+        {
+          return false;
+        }
+      }
+      static constexpr size_t cnt = kSegCount<C> - kSaturationCount<C>;
+      if constexpr (cnt != 0)
+      {
+        assert(0 <= lhs.p && lhs.p <= kSaturationCount<C>);
+        const auto lhs_start = lhs.segments + lhs.p;
+        const auto rhs_start = rhs.segments + rhs.p;
+        return std::memcmp(lhs_start, rhs_start, cnt * sizeof(uint16_t)) == 0;
+      }
+      return true;
+    }
+  };
+
+  template<typename C>
+  inline Extender<C> create()
+  {
+    Extender<C> extender;
+    extender.segments = allocate<typename C::len_t>(kSegCount<C>);
+    for (uint32_t i = 0; i < kSegCount<C>; i++)
+    {
+      // Note: there are sometimes trailing segments with zeros.
+      extender.segments[i] = (i <= C::kLength) ? 1 : 0;
+    }
+    // Reset the two windows, and the parity bit:
+    for (uint32_t i = 0; i < 2; i++)
+    {
+      extender._windows[i] = _mm_setzero_si128();
+      extender._last_seg_masks[i] = _mm_setzero_si128();
+    }
+    extender._counter = _mm_setzero_si128();
+    extender.parity_bit = 0b0;
+    extender.keys = fingerprint_keys<kSegCount<C>>();
+    extender.fingerprint = 0;
+    for (uint32_t i = 0; i < kSegCount<C> - kSaturationCount<C>; i++)
+    {
+      extender.fingerprint += extender.segments[i] * extender.keys[i];
+    }
+    extender.p = 0;
+    extender.steps = 0;
+    return std::move(extender);
+  }
+
+  template<typename C>
+  inline void destroy(Extender<C>& extender)
+  {
+    deallocate(extender.segments, kSegCount<C>);
+    extender.segments = nullptr;
+  }
+
+  // Copies the state of the given extender into another extender, e.g. to
+  // take a snapshot of it. The registers are copied as they are, so the copy
+  // continues with the same phase.
+  template<typename C>
+  inline void copy(Extender<C>& dst, const Extender<C>& src)
+  {
+    typename C::len_t* segments = dst.segments;
+    dst = src;
+    dst.segments = segments;
+    std::memcpy(segments, src.segments, kSegCount<C> * sizeof(typename C::len_t));
+  }
+
+  // Writes the lengths of the kLength + 1 segments of the extender to the
+  // given array, see the AVX2 implementation. The windows are passed on in
+  // the order that the AVX2 implementation uses: first the window that was
+  // just simulated as the current window, then the next window.
+  template<typename C>
+  inline void read_segments(const Extender<C>& extender, typename C::len_t* dst)
+  {
+    typedef typename C::len_t len_t;
+    len_t windows[2][kElemCount<C>];
+    len_t counters[1][kElemCount<C>];
+    for (uint32_t i = 0; i < 2; i++)
+    {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(windows[i]), extender._windows[extender.parity_bit ^ i ^ 0b1]);
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(counters[0]), extender._counter);
+    read_window_segments<C, kSegCount<C>, kSaturationCount<C>>(
+      extender.segments, extender.p, extender.steps, windows, counters, dst);
+  }
+
+  template<typename C>
+  inline void simulate_pulse(Extender<C>& extender)
+  {
+    // See the AVX2 implementation for details.
+    while (extender.p >= kSaturationCount<C>)
+    {
+      _Kernel<C>::_simulate_step(extender);
+    }
+    _Kernel<C>::_simulate_step(extender);
+    _Kernel<C>::_simulate_step(extender);
+  }
+
+  template<typename C>
+  inline bool equals(const Extender<C>& lhs, const Extender<C>& rhs)
+  {
+    // Only compare the segments if their fingerprints match.
+    return lhs.fingerprint == rhs.fingerprint && _Kernel<C>::_equals(lhs, rhs);
+  }
+
+  // Copies the windows as they are, rather than completing the pulses in
+  // them, see snaperz_fingerprint.h.
+  template<typename C>
+  inline void take_sample(const Extender<C>& extender, Sample& sample)
+  {
+    // Every sample of a loop check sees the same phase, see constants.h.
+    static_assert(LOOP_CHECK_INTERVAL % (kSaturationCount<C> / 2) == 0,
+                  "The phase of the windows must repeat between loop samples");
+    take_window_sample(extender.fingerprint, extender.p, extender._windows, sample);
+  }
+
+  template<typename C>
+  inline uint64_t fingerprint(const Extender<C>& extender)
+  {
+    Sample sample;
+    take_sample(extender, sample);
+    return sample_fingerprint(sample);
+  }
+
+  template<typename C>
+  inline bool finished(const Extender<C>& extender)
+  {
+    return _Kernel<C>::_finished(extender);
+  }
+} // namespace snaperz::sse41
+
+#pragma GCC pop_options
+#else // SNAPERZ_X86
+// There is a bug in snaperz_extender.h if this happens.
+#error "Requires an x86 target."
+#endif // !SNAPERZ_X86
@@ -0,0 +1,369 @@
+#pragma once
+
+// This implementation follows the AVX2 implementation, but packs the
+// segments into the bytes of plain 64-bit integers instead of vector
+// registers, i.e. SIMD within a register (SWAR). It only uses portable
+// integer arithmetic, which makes it the fastest engine on CPUs without
+// any of the vector extensions used by the other engines.
+//
+// Byte i of a window is element i, and is stored in bits 8i to 8i + 7. The
+// arithmetic is arranged such that no element ever overflows or underflows,
+// which allows using regular additions and subtractions on entire windows
+// without carries or borrows crossing into the neighbouring element.
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+
+#include "constants.h"
+#include "snaperz_memory.h"
+#include "snaperz_fingerprint.h"
+#include "snaperz_windows.h"
+
+namespace snaperz::swar
+{
+  // Hard limitation, since the elements are bytes. Longer extenders are
+  // simulated by one of the other engines instead.
+  template<typename C>
+  static constexpr bool kSupported =
+    std::numeric_limits<typename C::len_t>::max() <= std::numeric_limits<uint8_t>::max();
+
+  template<typename T>
+  static constexpr T to_multiple(T value, T n)
+  {
+    return (value + n - 1) / n * n;
+  }
+
+  // See the AVX2 implementation for details on the windows. Four windows
+  // are enough to keep the CPU busy, since every pair of windows only uses a
+  // handful of general purpose registers.
+  static constexpr uint32_t kElemCount = sizeof(uint64_t);
+  template<typename C>
+  static constexpr uint32_t kWindowCount =
+    std::min(UINT32_C(4), to_multiple((C::kLength + kElemCount) / kElemCount, UINT32_C(2)));
+  template<typename C>
+  static constexpr uint32_t kPairCount = kWindowCount<C> / 2;
+
+  // Like the AVX2 implementation, the extender is resident whenever it fits,
+  // padded with zero segments to fill the windows. The phase of the windows
+  // then repeats every kSaturationCount / 2 pulses, see fingerprint().
+  template<typename C>
+  static constexpr bool kResident = C::kLength + 1 <= kWindowCount<C> * kElemCount;
+  template<typename C>
+  static constexpr uint32_t kSegCount =
+    kResident<C> ? kWindowCount<C> * kElemCount : C::kLength + 1;
+  template<typename C>
+  static constexpr uint32_t kSaturationCount =
+    std::min(kSegCount<C>, kWindowCount<C> * kElemCount);
+  // The number of elements in use in each window.
+  template<typename C>
+  static constexpr uint32_t kLaneCount = kSaturationCount<C> / kWindowCount<C>;
+  template<typename C>
+  static constexpr uint32_t kLastShift = 8 * (kLaneCount<C> - 1);
+
+  // Every element set to one, and every element set to its highest bit.
+  static constexpr uint64_t kOnes = UINT64_C(0x0101010101010101);
+  static constexpr uint64_t kHighs = UINT64_C(0x8080808080808080);
+  static constexpr uint64_t kLows = ~kHighs;
+
+  template<typename C>
+  struct Extender
+  {
+    uint8_t* segments;
+    // The active windows, see the AVX2 implementation.
+    uint64_t _windows[kWindowCount<C>];
+    // The number of blocks seen by every pulse, one for every pair.
+    uint64_t _counters[kPairCount<C>];
+    // The last segment masks computed by the last step, one for every pair.
+    uint64_t _last_seg_masks[kPairCount<C>];
+    // The position of the sequence which is first in the active window.
+    size_t p;
+    // The total number of steps that have been simulated. This is no longer
+    // updated when resident, once the windows have been saturated.
+    uint64_t steps;
+    // Whether the extender had finished after the last simulated pulse.
+    bool done;
+    // The fingerprint of the segments outside of the windows, which is
+    // compared by equals() before the segments, see snaperz_fingerprint.h.
+    uint64_t fingerprint;
+    // The keys of the fingerprint.
+    const uint64_t* keys;
+  };
+
+  // Moves the fingerprint along with the segments outside of the windows,
+  // which start at p. Every step, the segment at p enters the windows, and
+  // the segment that was just stored leaves them.
+  template<typename C>
+  inline void _update_fingerprint(Extender<C>& extender)
+  {
+    static constexpr uint32_t cnt = kSegCount<C> - kSaturationCount<C>;
+    if constexpr (cnt != 0)
+    {
+      const auto i = (extender.p + cnt) % kSegCount<C>;
+      extender.fingerprint += extender.segments[i] * extender.keys[i] -
+                              extender.segments[extender.p] * extender.keys[extender.p];
+    }
+  }
+
+  // Expands the highest bit of every element to the entire element.
+  inline uint64_t _expand(uint64_t highs)
+  {
+    return (highs >> 7) * 0xFF;
+  }
+
+  // Computes a mask of the elements that are zero. Clearing the highest bit
+  // first ensures that the addition never carries into the next element.
+  inline uint64_t _zero_mask(uint64_t value)
+  {
+    return _expand(~(((value & kLows) + kLows) | value) & kHighs);
+  }
+
+  inline uint64_t _equal_mask(uint64_t lhs, uint64_t rhs)
+  {
+    return _zero_mask(lhs ^ rhs);
+  }
+
+  // Computes a mask of the elements of lhs that are greater than those of
+  // rhs. Every element of rhs must be less than 128.
+  inline uint64_t _greater_mask(uint64_t lhs, uint64_t rhs)
+  {
+    return _expand((((lhs & kLows) + (kLows - rhs)) | lhs) & kHighs);
+  }
+
+  template<typename C>
+  inline void _simulate_pair(uint64_t& curr, uint64_t& next, uint64_t& counter, uint64_t& last_seg_mask)
+  {
+    // See the AVX2 implementation for details. The differences are in the
+    // order of the operations, which never leave the range of an element.
+    static constexpr uint64_t kPushLimits = C::kPushLimit * kOnes;
+    static constexpr uint64_t kLastPushLimits = C::kLastPushLimit * kOnes;
+    static constexpr uint64_t kLenPlusOnes = static_cast<uint8_t>(C::kLength + 1) * kOnes;
+    static_assert(C::kLastPushLimit < 128, "The push limits must fit in 7 bits");
+
+    counter += curr;
+    last_seg_mask = _equal_mask(counter, kLenPlusOnes);
+    // Handle pushing case:
+    //   Compute the saturated curr - 1, which is zero for segments of length
+    //   zero and one. Those segments push nothing, so no masking is needed.
+    const uint64_t curr_minus_one = curr - (~_zero_mask(curr) & kOnes);
+    const uint64_t curr_push_limit =
+      (kPushLimits & ~last_seg_mask) | (kLastPushLimits & last_seg_mask);
+    const uint64_t above_limit_mask = _greater_mask(curr_minus_one, curr_push_limit);
+    const uint64_t push_delta =
+      (curr_minus_one & ~above_limit_mask) | (curr_push_limit & above_limit_mask);
+    // Handle pulling case:
+    const uint64_t pull_delta = next & ~last_seg_mask & _equal_mask(curr, kOnes);
+    // Apply the deltas such that every intermediate result is in range. The
+    // counter always includes the current segment, which is at least as
+    // large as the push delta.
+    curr = curr - push_delta + pull_delta;
+    next = next - pull_delta + push_delta;
+    counter = counter - push_delta + pull_delta;
+    last_seg_mask = _equal_mask(counter, kLenPlusOnes);
+    counter &= ~last_seg_mask;
+  }
+
+  template<typename C>
+  inline void _simulate_windows(Extender<C>& extender, uint64_t last)
+  {
+    for (uint32_t i = 0; i < kWindowCount<C> - 1; i++)
+    {
+      extender._windows[i] = extender._windows[i + 1];
+    }
+    extender._windows[kWindowCount<C> - 1] = last;
+    for (uint32_t i = 0; i < kPairCount<C>; i++)
+    {
+      _simulate_pair<C>(
+        extender._windows[2 * i],
+        extender._windows[2 * i + 1],
+        extender._counters[i],
+        extender._last_seg_masks[i]
+      );
+    }
+  }
+
+  template<typename C>
+  inline void _simulate_step(Extender<C>& extender)
+  {
+    // See the AVX2 implementation for details.
+    uint64_t last = extender._windows[0];
+    if (extender.steps >= kSaturationCount<C>)
+    {
+      const auto i = (extender.p + (kSegCount<C> - kSaturationCount<C>)) % kSegCount<C>;
+      extender.segments[i] = static_cast<uint8_t>(last);
+    }
+    // The elements that are not in use are always zero, so shifting in a
+    // zero leaves room for the next segment in the last element in use.
+    last = (last >> 8) | (static_cast<uint64_t>(extender.segments[extender.p]) << kLastShift<C>);
+    _simulate_windows(extender, last);
+    _update_fingerprint(extender);
+    extender.p = (extender.p + 1) % kSegCount<C>;
+    extender.steps++;
+  }
+
+  template<typename C>
+  inline void _simulate_resident_pulse(Extender<C>& extender)
+  {
+    // See the AVX2 implementation for details.
+    for (uint32_t i = 0; i < 2; i++)
+    {
+      const uint64_t first = extender._windows[0];
+      _simulate_windows(extender, (first >> 8) | ((first & 0xFF) << kLastShift<C>));
+    }
+    extender.p = (extender.p + 2) % kSegCount<C>;
+  }
+
+  template<typename C>
+  inline bool _finished(const Extender<C>& extender)
+  {
+    // See the AVX2 implementation for details.
+    assert(0 <= extender.p && extender.p <= kSaturationCount<C>);
+    assert((extender.p & 0x1) == 0);
+    const uint32_t index = (extender.p > 0) * (kSaturationCount<C> - extender.p);
+    const uint32_t first_seg_index = index / kWindowCount<C>;
+    const uint32_t pair = (index % kWindowCount<C>) / 2;
+    return (extender._last_seg_masks[pair] >> (8 * first_seg_index)) & 0x1;
+  }
+
+  template<typename C>
+  inline Extender<C> create()
+  {
+    Extender<C> extender;
+    extender.segments = allocate<uint8_t>(kSegCount<C>);
+    for (uint32_t i = 0; i < kSegCount<C>; i++)
+    {
+      // Note: there are sometimes trailing segments with zeros.
+      extender.segments[i] = (i <= C::kLength) ? 1 : 0;
+    }
+    for (uint32_t i = 0; i < kWindowCount<C>; i++)
+    {
+      extender._windows[i] = 0;
+    }
+    for (uint32_t i = 0; i < kPairCount<C>; i++)
+    {
+      extender._counters[i] = 0;
+      extender._last_seg_masks[i] = 0;
+    }
+    extender.keys = fingerprint_keys<kSegCount<C>>();
+    extender.fingerprint = 0;
+    for (uint32_t i = 0; i < kSegCount<C> - kSaturationCount<C>; i++)
+    {
+      extender.fingerprint += extender.segments[i] * extender.keys[i];
+    }
+    extender.p = 0;
+    extender.steps = 0;
+    extender.done = false;
+    return std::move(extender);
+  }
+
+  template<typename C>
+  inline void destroy(Extender<C>& extender)
+  {
+    deallocate(extender.segments, kSegCount<C>);
+    extender.segments = nullptr;
+  }
+
+  // Copies the state of the given extender into another extender, e.g. to
+  // take a snapshot of it. The registers are copied as they are, so the copy
+  // continues with the same phase.
+  template<typename C>
+  inline void copy(Extender<C>& dst, const Extender<C>& src)
+  {
+    uint8_t* segments = dst.segments;
+    dst = src;
+    dst.segments = segments;
+    std::memcpy(segments, src.segments, kSegCount<C> * sizeof(uint8_t));
+  }
+
+  // Writes the lengths of the kLength + 1 segments of the extender to the
+  // given array, see the AVX2 implementation.
+  template<typename C>
+  inline void read_segments(const Extender<C>& extender, uint8_t* dst)
+  {
+    uint8_t windows[kWindowCount<C>][kElemCount];
+    uint8_t counters[kPairCount<C>][kElemCount];
+    for (uint32_t e = 0; e < kElemCount; e++)
+    {
+      for (uint32_t i = 0; i < kWindowCount<C>; i++)
+      {
+        windows[i][e] = static_cast<uint8_t>(extender._windows[i] >> (8 * e));
+      }
+      for (uint32_t i = 0; i < kPairCount<C>; i++)
+      {
+        counters[i][e] = static_cast<uint8_t>(extender._counters[i] >> (8 * e));
+      }
+    }
+    read_window_segments<C, kSegCount<C>, kSaturationCount<C>>(
+      extender.segments, extender.p, extender.steps, windows, counters, dst);
+  }
+
+  template<typename C>
+  inline void simulate_pulse(Extender<C>& extender)
+  {
+    // See the AVX2 implementation for details.
+    if constexpr (kResident<C>)
+    {
+      if (extender.steps >= kSaturationCount<C>)
+      {
+        _simulate_resident_pulse(extender);
+        extender.done = _finished(extender);
+        return;
+      }
+    }
+    while (extender.p >= kSaturationCount<C>)
+    {
+      _simulate_step(extender);
+    }
+    _simulate_step(extender);
+    _simulate_step(extender);
+    extender.done = _finished(extender);
+  }
+
+  template<typename C>
+  inline bool equals(const Extender<C>& lhs, const Extender<C>& rhs)
+  {
+    // See the AVX2 implementation for details.
+    if (lhs.p != rhs.p || lhs.fingerprint != rhs.fingerprint)
+    {
+      return false;
+    }
+    for (uint32_t i = 0; i < kWindowCount<C>; i++)
+    {
+      if (lhs._windows[i] != rhs._windows[i])
+      {
+        return false;
+      }
+    }
+    static constexpr size_t cnt = kSegCount<C> - kSaturationCount<C>;
+    if constexpr (cnt != 0)
+    {
+      assert(0 <= lhs.p && lhs.p <= kSaturationCount<C>);
+      return std::memcmp(lhs.segments + lhs.p, rhs.segments + rhs.p, cnt) == 0;
+    }
+    return true;
+  }
+
+  // Copies the windows as they are, rather than completing the pulses in
+  // them, see snaperz_fingerprint.h.
+  template<typename C>
+  inline void take_sample(const Extender<C>& extender, Sample& sample)
+  {
+    // Every sample of a loop check sees the same phase, see constants.h.
+    static_assert(LOOP_CHECK_INTERVAL % (kSaturationCount<C> / 2) == 0,
+                  "The phase of the windows must repeat between loop samples");
+    take_window_sample(extender.fingerprint, extender.p, extender._windows, sample);
+  }
+
+  template<typename C>
+  inline uint64_t fingerprint(const Extender<C>& extender)
+  {
+    Sample sample;
+    take_sample(extender, sample);
+    return sample_fingerprint(sample);
+  }
+
+  template<typename C>
+  inline bool finished(const Extender<C>& extender)
+  {
+    return extender.done;
+  }
+} // namespace snaperz::swar
@@ -0,0 +1,118 @@
+#pragma once
+
+// Loops are found by comparing extenders after every pulse, see
+// snaperz_loop.h.
+// Rather than comparing every segment, the engines keep a fingerprint of
+// their segments, which is updated whenever a segment is stored. The
+// fingerprint is the sum of the length of every segment, multiplied by a
+// random key for its position, so storing a segment only adds the
+// difference between its new and old length times its key. Extenders with
+// different fingerprints are never equal, while equal fingerprints are
+// confirmed by comparing the segments. Fingerprints also serve as hash keys.
+//
+// The engines that keep several pulses in flight only keep the fingerprint of
+// the segments outside of their windows up to date. The rest of their
+// fingerprint is the phase and the windows as they are, see Sample, which
+// costs the same after every pulse. Completing the pulses in flight instead,
+// see snaperz_windows.h, costs a pass over the segments. Their fingerprints
+// therefore differ for the same segments at different phases, so their
+// loops are confirmed on the segments themselves, see snaperz_loop.h.
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+namespace snaperz
+{
+  constexpr uint64_t _fingerprint_mix(uint64_t x)
+  {
+    // The finalizer of MurmurHash3, which spreads every input bit over the
+    // whole output.
+    x ^= x >> 33;
+    x *= UINT64_C(0xff51afd7ed558ccd);
+    x ^= x >> 33;
+    x *= UINT64_C(0xc4ceb9fe1a85ec53);
+    x ^= x >> 33;
+    return x;
+  }
+
+  // The keys of the first kCount positions. The keys are the same for every
+  // extender, so their fingerprints can be compared.
+  template<uint32_t kCount>
+  inline const uint64_t* fingerprint_keys()
+  {
+    static const std::vector<uint64_t> keys = []()
+    {
+      std::vector<uint64_t> keys(kCount);
+      for (uint32_t i = 0; i < kCount; i++)
+      {
+        keys[i] = _fingerprint_mix(i + UINT64_C(0x9e3779b97f4a7c15));
+      }
+      return keys;
+    }();
+    return keys.data();
+  }
+
+  template<size_t kCount>
+  constexpr std::array<uint64_t, kCount> _sample_keys()
+  {
+    std::array<uint64_t, kCount> keys = {};
+    for (size_t i = 0; i < kCount; i++)
+    {
+      keys[i] = _fingerprint_mix(~static_cast<uint64_t>(i));
+    }
+    return keys;
+  }
+
+  // The most words of state that an engine adds to its fingerprint: the phase
+  // and the windows of the AVX2 and AVX-512 engines.
+  static constexpr uint32_t kSampleWordCount = 1 + 128 / sizeof(uint64_t);
+
+  // The state of an extender that its fingerprint is computed from, copied
+  // as it is by take_sample(), see snaperz_extender.h. Taking a sample only
+  // copies a few words, so the fingerprint can be computed by another thread,
+  // see snaperz_loop_thread.h.
+  struct Sample
+  {
+    // The fingerprint that the engine keeps up to date itself.
+    uint64_t fingerprint;
+    // The words of the rest of the state, e.g. the phase and the registers
+    // of the windows, which are only in the fingerprint of the sample.
+    uint32_t word_count;
+    uint64_t words[kSampleWordCount];
+  };
+
+  // Returns the fingerprint of the extender that the sample was taken of.
+  // Like the segments, every word of the sample is multiplied by a random
+  // key of its own.
+  inline uint64_t sample_fingerprint(const Sample& sample)
+  {
+    static constexpr std::array<uint64_t, kSampleWordCount> keys =
+      _sample_keys<kSampleWordCount>();
+    uint64_t fingerprint = sample.fingerprint;
+    for (uint32_t i = 0; i < sample.word_count; i++)
+    {
+      fingerprint += sample.words[i] * keys[i];
+    }
+    return fingerprint;
+  }
+
+  // Copies the phase and the windows of an engine that keeps several pulses
+  // in flight into the given sample, together with the fingerprint of the
+  // segments outside of the windows.
+  template<typename W>
+  inline void take_window_sample(uint64_t fingerprint, size_t p, const W& windows, Sample& sample)
+  {
+    // Note: W is an array of registers, whose size is divided by the size of
+    //       a word rather than of its elements.
+    constexpr size_t kSize = sizeof(W);
+    static_assert(kSize % sizeof(uint64_t) == 0, "Windows must consist of whole words");
+    constexpr uint32_t kWordCount = 1 + kSize / sizeof(uint64_t);
+    static_assert(kWordCount <= kSampleWordCount, "Windows must fit in a sample");
+    sample.fingerprint = fingerprint;
+    sample.word_count = kWordCount;
+    sample.words[0] = p;
+    std::memcpy(sample.words + 1, &windows, kSize);
+  }
+} // namespace snaperz
@@ -0,0 +1,138 @@
+#pragma once
+
+// Extenders that are not compiled into the program are simulated by kernels,
+// which are compiled on demand. A kernel is main.cpp compiled as a shared
+// object for a single extender, see SNAPERZ_KERNEL_LENGTH in main.cpp. Every
+// kernel is optimized for the CPU of the host, and is cached on disk, so an
+// extender is only compiled once for every CPU.
+//
+// The kernels are stored in the cache directory, see snaperz_cache.h. The
+// compiler is taken from $SNAPERZ_CXX, or is the one that compiled the
+// program.
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <iostream>
+#include <filesystem>
+#include <system_error>
+#include <dlfcn.h>
+#include <unistd.h>
+
+#include "snaperz_extender.h"
+#include "snaperz_cache.h"
+
+#ifndef SNAPERZ_CXX
+#define SNAPERZ_CXX "c++"
+#endif // !SNAPERZ_CXX
+
+namespace snaperz::kernel
+{
+  // The function exported by every kernel, which simulates its extender and
+  // returns the exit status of the program.
+  typedef int (*EntryPoint)();
+  static constexpr const char* kEntryPoint = "snaperz_kernel_main";
+
+#if _DEBUG
+  static constexpr const char* kFlags = "-std=c++17 -O0 -g -D_DEBUG=1";
+#else // _DEBUG
+  static constexpr const char* kFlags = "-std=c++17 -O3 -DNDEBUG -D_DEBUG=0";
+#endif // !_DEBUG
+
+  // Identifies the kernels that can be loaded by this program. Kernels are
+  // compiled with -march=native, so the key includes the features of the
+  // CPU, and the build of the program, since the sources might have changed.
+  inline std::string _key(uint32_t length, uint32_t period)
+  {
+    // Note: the builtin only accepts string literals.
+    std::string features;
+#if SNAPERZ_X86
+    features += __builtin_cpu_supports("sse4.1") ? '1' : '0';
+    features += __builtin_cpu_supports("avx") ? '1' : '0';
+    features += __builtin_cpu_supports("avx2") ? '1' : '0';
+    features += __builtin_cpu_supports("bmi2") ? '1' : '0';
+    features += __builtin_cpu_supports("avx512f") ? '1' : '0';
+    features += __builtin_cpu_supports("avx512bw") ? '1' : '0';
+    features += __builtin_cpu_supports("avx512vl") ? '1' : '0';
+#endif // SNAPERZ_X86
+    // FNV-1a hash of the build.
+    uint64_t build = UINT64_C(0xcbf29ce484222325);
+    for (const char* c = __DATE__ " " __TIME__ " " __VERSION__; *c != '\0'; c++)
+    {
+      build = (build ^ static_cast<uint8_t>(*c)) * UINT64_C(0x100000001b3);
+    }
+    char key[128];
+    std::snprintf(key, sizeof(key), "L%u-P%u-%s-%016llx%s", length, period,
+                  features.c_str(), static_cast<unsigned long long>(build),
+                  _DEBUG ? "-debug" : "");
+    return key;
+  }
+
+  // Compiles the kernel for the given extender to the given path.
+  inline bool _compile(uint32_t length, uint32_t period, const std::filesystem::path& path)
+  {
+    // The source of main.cpp is next to this file.
+    const std::filesystem::path source =
+      std::filesystem::absolute(std::filesystem::path(__FILE__).parent_path() / "main.cpp");
+    const char* compiler = std::getenv("SNAPERZ_CXX");
+    // Compile to a temporary file first, which is then renamed. Renaming is
+    // atomic, so concurrent runs never load a partially written kernel.
+    const std::filesystem::path tmp =
+      path.string() + ".tmp" + std::to_string(getpid());
+    const std::string command =
+      std::string(compiler ? compiler : SNAPERZ_CXX) + " " + kFlags +
+      " -march=native -shared -fPIC -fvisibility=hidden" +
+      " -DSNAPERZ_KERNEL_LENGTH=" + std::to_string(length) +
+      " -DSNAPERZ_KERNEL_PERIOD=" + std::to_string(period) +
+      " -o '" + tmp.string() + "' '" + source.string() + "'";
+    if (std::system(command.c_str()) != 0)
+    {
+      std::filesystem::remove(tmp);
+      return false;
+    }
+    std::error_code error;
+    std::filesystem::rename(tmp, path, error);
+    return !error;
+  }
+
+  // Simulates the given extender with its kernel, which is compiled first if
+  // it is not in the cache yet. The exit status of the kernel is stored in
+  // the given status. Returns false if the kernel could not be compiled or
+  // loaded.
+  inline bool run(uint32_t length, uint32_t period, int& status)
+  {
+    const std::filesystem::path dir = cache_dir();
+    const std::filesystem::path path = dir / ("kernel-" + _key(length, period) + ".so");
+    if (!std::filesystem::exists(path))
+    {
+      std::cout
+        << "Compiling kernel for the "
+        << length << " extender with a "
+        << period << " tick period..."
+        << std::endl;
+      std::error_code error;
+      std::filesystem::create_directories(dir, error);
+      if (error || !_compile(length, period, path))
+      {
+        std::cerr << "Failed to compile " << path.string() << "." << std::endl;
+        return false;
+      }
+    }
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr)
+    {
+      std::cerr << "Failed to load kernel: " << dlerror() << std::endl;
+      return false;
+    }
+    EntryPoint entry_point = reinterpret_cast<EntryPoint>(dlsym(handle, kEntryPoint));
+    if (entry_point == nullptr)
+    {
+      std::cerr << "Failed to load kernel: " << dlerror() << std::endl;
+      dlclose(handle);
+      return false;
+    }
+    status = entry_point();
+    dlclose(handle);
+    return true;
+  }
+} // namespace snaperz::kernel
@@ -0,0 +1,295 @@
+#pragma once
+
+// An extender that never finishes eventually repeats one of its states, after
+// which it repeats every state from there on. The number of pulses before
+// that first state is the start of the loop, and the number of pulses until it
+// repeats is the length of the loop.
+//
+// Loops are noticed by taking a sample of the extender, i.e. its fingerprint,
+// see snaperz_fingerprint.h, every LOOP_CHECK_INTERVAL pulses, and comparing
+// it with earlier samples, either with Brent's algorithm or with a table of
+// distinguished samples, see snaperz_loop_table.h. The engines that keep
+// several pulses in flight fingerprint the phase of their windows as well,
+// which repeats every few pulses, so every sample is taken at the same
+// phase. The samples repeat with a period of lcm(loop length,
+// LOOP_CHECK_INTERVAL) pulses, and fingerprints can collide, so that only
+// tells that the extender may have looped, by some multiple of the loop
+// length. The start and length of the loop are therefore confirmed on the
+// segments themselves, see read_segments(), which are the same regardless of
+// the phase of the engine.
+//
+// The samples are either checked in between pulses, or by a second thread,
+// see snaperz_loop_thread.h. Both check the same samples in the same way, so
+// they notice the same loops after the same number of pulses.
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "snaperz_extender.h"
+#include "snaperz_loop_table.h"
+
+namespace snaperz
+{
+  // How the loops of a single extender are found.
+  enum class LoopCheck
+  {
+    // Simulate the extender until it finishes, without checking for loops.
+    kNone,
+    // Compare the samples with a snapshot sample, which is moved up to the
+    // samples whenever their distance reaches the next power of two.
+    kBrent,
+    // Remember the distinguished samples, see snaperz_loop_table.h.
+    kDistinguishedPoints,
+  };
+
+  struct Loop
+  {
+    // The number of pulses at which the loop was noticed.
+    uint64_t pulses;
+    // The number of pulses after which the states of the extender repeat.
+    uint64_t length;
+    // The number of pulses before the extender enters the loop.
+    uint64_t start;
+  };
+
+  // The earlier samples of an extender, which are checked for a sample with
+  // the same fingerprint.
+  struct SampleCheck
+  {
+    LoopCheck check;
+    // The distinguished samples.
+    LoopTable table;
+    // Brent's algorithm. Rather than simulating a second extender at half the
+    // speed, the samples are compared with a snapshot sample. The snapshot
+    // is moved up to the samples whenever the distance between them reaches
+    // the next power of two, so the samples meet the snapshot at most two
+    // loops after the extender enters the loop.
+    uint64_t snapshot_pulses;
+    uint64_t snapshot_fingerprint;
+    uint64_t samples;
+    uint64_t snapshot_samples;
+    uint64_t snapshot_distance;
+  };
+
+  inline SampleCheck create_sample_check(LoopCheck check)
+  {
+    SampleCheck state = {};
+    state.check = check;
+    if (check == LoopCheck::kDistinguishedPoints)
+    {
+      state.table = create_loop_table(LOOP_TABLE_SIZE);
+    }
+    state.snapshot_distance = 1;
+    return state;
+  }
+
+  inline void destroy_sample_check(SampleCheck& state)
+  {
+    if (state.check == LoopCheck::kDistinguishedPoints)
+    {
+      destroy_loop_table(state.table);
+    }
+  }
+
+  // Checks the sample of an extender with the given fingerprint after the
+  // given number of pulses. Returns true if an earlier sample has the same
+  // fingerprint, with the number of pulses since that sample in distance.
+  inline bool check_sample(SampleCheck& state, uint64_t pulses, uint64_t fingerprint,
+                           uint64_t& distance)
+  {
+    switch (state.check)
+    {
+    case LoopCheck::kNone:
+      break;
+    case LoopCheck::kBrent:
+      if (state.samples == 0)
+      {
+        state.snapshot_pulses = pulses;
+        state.snapshot_fingerprint = fingerprint;
+      }
+      else if (fingerprint == state.snapshot_fingerprint)
+      {
+        distance = pulses - state.snapshot_pulses;
+        return true;
+      }
+      else if (state.samples - state.snapshot_samples == state.snapshot_distance)
+      {
+        state.snapshot_pulses = pulses;
+        state.snapshot_fingerprint = fingerprint;
+        state.snapshot_samples = state.samples;
+        state.snapshot_distance *= 2;
+      }
+      state.samples++;
+      break;
+    case LoopCheck::kDistinguishedPoints:
+      uint64_t earlier_pulses;
+      if (visit_loop_table(state.table, fingerprint, pulses, earlier_pulses))
+      {
+        distance = pulses - earlier_pulses;
+        return true;
+      }
+      break;
+    }
+    return false;
+  }
+
+  // The segments of two extenders, see read_segments().
+  template<typename C>
+  struct _SegmentPair
+  {
+    std::vector<typename C::len_t> lhs = std::vector<typename C::len_t>(C::kLength + 1);
+    std::vector<typename C::len_t> rhs = std::vector<typename C::len_t>(C::kLength + 1);
+  };
+
+  template<typename C>
+  inline bool _same_segments(const Extender<C>& lhs, const Extender<C>& rhs,
+                             _SegmentPair<C>& segments)
+  {
+    read_segments(lhs, segments.lhs.data());
+    read_segments(rhs, segments.rhs.data());
+    return segments.lhs == segments.rhs;
+  }
+
+  // Finds the length of the loop of the given extender, which has the same
+  // segments again after the given distance if it is in a loop. The length
+  // of the loop divides that distance, so the extender is only compared at
+  // the divisors of the distance. Returns 0 if the extender is not in a loop,
+  // i.e. if the loop was suspected because of a fingerprint collision.
+  template<typename C>
+  uint64_t find_loop_length(const Extender<C>& extender, uint64_t distance)
+  {
+    _SegmentPair<C> segments;
+    read_segments(extender, segments.lhs.data());
+    Extender<C> probe = create<C>(extender.backend);
+    copy(probe, extender);
+    uint64_t loop_length = 0;
+    for (uint64_t i = 1; i <= distance; i++)
+    {
+      simulate_pulse(probe);
+      if (distance % i != 0)
+      {
+        continue;
+      }
+      read_segments(probe, segments.rhs.data());
+      if (segments.lhs == segments.rhs)
+      {
+        loop_length = i;
+        break;
+      }
+    }
+    destroy(probe);
+    return loop_length;
+  }
+
+  // Finds the number of pulses before the extender C enters its loop of the
+  // given length, i.e. the first pulse at which the extender has the same
+  // segments as loop_length pulses later. The two extenders are compared
+  // once every LOOP_CHECK_INTERVAL pulses, after which the interval in which
+  // they first have the same segments is simulated again, pulse by pulse.
+  template<typename C>
+  uint64_t find_loop_start(Backend backend, uint64_t loop_length)
+  {
+    _SegmentPair<C> segments;
+    Extender<C> start = create<C>(backend);
+    Extender<C> end = create<C>(backend);
+    for (uint64_t i = 0; i < loop_length; i++)
+    {
+      simulate_pulse(end);
+    }
+    Extender<C> start_snapshot = create<C>(backend);
+    Extender<C> end_snapshot = create<C>(backend);
+    uint64_t loop_start = 0;
+    while (!_same_segments(start, end, segments))
+    {
+      copy(start_snapshot, start);
+      copy(end_snapshot, end);
+      for (uint64_t i = 0; i < LOOP_CHECK_INTERVAL; i++)
+      {
+        simulate_pulse(start);
+        simulate_pulse(end);
+      }
+      loop_start += LOOP_CHECK_INTERVAL;
+    }
+    if (loop_start != 0)
+    {
+      copy(start, start_snapshot);
+      copy(end, end_snapshot);
+      loop_start -= LOOP_CHECK_INTERVAL;
+      while (!_same_segments(start, end, segments))
+      {
+        simulate_pulse(start);
+        simulate_pulse(end);
+        loop_start++;
+      }
+    }
+    destroy(start);
+    destroy(end);
+    destroy(start_snapshot);
+    destroy(end_snapshot);
+    return loop_start;
+  }
+
+  // Confirms that the given extender, after the given number of pulses, has
+  // the same segments as the given distance earlier, and finds the start and
+  // length of its loop. Returns false if it does not.
+  template<typename C>
+  bool confirm_loop(const Extender<C>& extender, uint64_t pulses, uint64_t distance, Loop& loop)
+  {
+    const uint64_t loop_length = find_loop_length(extender, distance);
+    if (loop_length == 0)
+    {
+      return false;
+    }
+    loop = { pulses, loop_length, find_loop_start<C>(extender.backend, loop_length) };
+    return true;
+  }
+
+  // Simulates the given extender until it finishes or loops, and checks for
+  // loops in between pulses. Returns true if it loops. The given function is
+  // called every LOGGING_INTERVAL pulses with the number of pulses so far.
+  template<typename C>
+  bool simulate_with_loop_check(Extender<C>& extender, uint64_t& pulses, LoopCheck check,
+                                const std::function<void(uint64_t)>& on_status, Loop& loop)
+  {
+    uint64_t pulses_since_last_status_update = 0;
+    uint64_t pulses_since_last_sample = 0;
+
+    // Samples are taken from the initial state on.
+    SampleCheck samples = create_sample_check(check);
+    uint64_t distance;
+    if (check != LoopCheck::kNone)
+    {
+      check_sample(samples, pulses, fingerprint(extender), distance);
+    }
+
+    bool looped = false;
+    while (!looped && !finished(extender))
+    {
+      simulate_pulse(extender);
+      pulses++;
+
+      pulses_since_last_status_update++;
+      if (pulses_since_last_status_update == LOGGING_INTERVAL)
+      {
+        pulses_since_last_status_update = 0;
+        if (on_status)
+        {
+          on_status(pulses);
+        }
+      }
+
+      pulses_since_last_sample++;
+      if (pulses_since_last_sample == LOOP_CHECK_INTERVAL && check != LoopCheck::kNone)
+      {
+        pulses_since_last_sample = 0;
+        if (check_sample(samples, pulses, fingerprint(extender), distance))
+        {
+          // Unless the fingerprints collided, the extender has looped.
+          looped = confirm_loop(extender, pulses, distance, loop);
+        }
+      }
+    }
+    destroy_sample_check(samples);
+    return looped;
+  }
+} // namespace snaperz
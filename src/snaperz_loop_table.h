@@ -0,0 +1,151 @@
+#pragma once
+
+// Brent's algorithm only notices a loop once the extender has gone around it
+// at least once after the snapshot was taken, and the snapshot is taken up
+// to twice as many pulses after the loop starts. For extenders that take
+// billions of pulses to enter a short loop, that is a long wait. Instead,
+// every state of the extender whose fingerprint, see snaperz_fingerprint.h,
+// starts with a number of zero bits is "distinguished", and is remembered in a
+// table together with the number of pulses at which it occurred. The first
+// distinguished state in the loop is then seen again one loop later, which
+// is at most one loop and about 2^bits pulses after the loop starts.
+// Fingerprints are sums, and the carries of every term reach their highest
+// bits, which is why those bits are used.
+//
+// The table never grows. Once it fills up, a further bit has to be zero,
+// which drops about half of the remembered states, so the memory of a run is
+// fixed in advance, no matter how many pulses it takes.
+#include <cstdint>
+
+#include "snaperz_memory.h"
+
+namespace snaperz
+{
+  struct LoopTable
+  {
+    struct Entry
+    {
+      uint64_t fingerprint;
+      uint64_t pulses;
+    };
+    // Open addressing with linear probing. Empty entries have _kNoPulses pulses.
+    Entry* entries;
+    uint64_t capacity;
+    uint64_t size;
+    // The largest fingerprint of a distinguished state.
+    uint64_t limit;
+    // Shifts a hashed fingerprint down to an index.
+    uint32_t shift;
+  };
+
+  static constexpr uint64_t _kNoPulses = UINT64_MAX;
+
+  // Creates a table of the given number of entries, which must be a power of
+  // two, and at least 2. Every state is distinguished until the table fills
+  // up.
+  inline LoopTable create_loop_table(uint64_t capacity)
+  {
+    uint32_t shift = 64;
+    for (uint64_t i = capacity; i > 1; i /= 2)
+    {
+      shift--;
+    }
+    LoopTable table = { allocate<LoopTable::Entry>(capacity), capacity, 0, UINT64_MAX, shift };
+    for (uint64_t i = 0; i < capacity; i++)
+    {
+      table.entries[i] = { 0, _kNoPulses };
+    }
+    return table;
+  }
+
+  inline void destroy_loop_table(LoopTable& table)
+  {
+    deallocate(table.entries, table.capacity);
+    table.entries = nullptr;
+  }
+
+  inline uint64_t _table_home(const LoopTable& table, uint64_t fingerprint)
+  {
+    // The highest bits are zero for distinguished states, so hash them first.
+    return (fingerprint * UINT64_C(0x9e3779b97f4a7c15)) >> table.shift;
+  }
+
+  // Removes the given entry, and moves up the entries after it, which keeps
+  // every entry reachable from its home without crossing an empty entry.
+  inline void _table_erase(LoopTable& table, uint64_t hole)
+  {
+    const uint64_t index_mask = table.capacity - 1;
+    uint64_t i = hole;
+    while (true)
+    {
+      i = (i + 1) & index_mask;
+      if (table.entries[i].pulses == _kNoPulses)
+      {
+        break;
+      }
+      // Entries whose home lies cyclically in (hole, i] stay where they are.
+      const uint64_t home = _table_home(table, table.entries[i].fingerprint);
+      if (((i - home) & index_mask) < ((i - hole) & index_mask))
+      {
+        continue;
+      }
+      table.entries[hole] = table.entries[i];
+      hole = i;
+    }
+    table.entries[hole] = { 0, _kNoPulses };
+    table.size--;
+  }
+
+  // Requires one more zero bit of distinguished states, and drops the states
+  // that no longer are.
+  inline void _add_distinguished_bit(LoopTable& table)
+  {
+    table.limit /= 2;
+    for (uint64_t i = 0; i < table.capacity; i++)
+    {
+      // Erasing moves later entries into this one, which are checked as well.
+      while (table.entries[i].pulses != _kNoPulses &&
+             table.entries[i].fingerprint > table.limit)
+      {
+        _table_erase(table, i);
+      }
+    }
+  }
+
+  __attribute__((noinline))
+  inline bool _visit_distinguished(LoopTable& table, uint64_t fingerprint, uint64_t pulses,
+                                   uint64_t& earlier_pulses)
+  {
+    const uint64_t index_mask = table.capacity - 1;
+    uint64_t i = _table_home(table, fingerprint);
+    for (; table.entries[i].pulses != _kNoPulses; i = (i + 1) & index_mask)
+    {
+      if (table.entries[i].fingerprint == fingerprint)
+      {
+        earlier_pulses = table.entries[i].pulses;
+        return true;
+      }
+    }
+    table.entries[i] = { fingerprint, pulses };
+    table.size++;
+    // Keep the table at most three quarters full, which keeps probing short.
+    while (table.size * 4 > table.capacity * 3)
+    {
+      _add_distinguished_bit(table);
+    }
+    return false;
+  }
+
+  // Remembers the state with the given fingerprint after the given number of
+  // pulses, if it is distinguished. Returns true if it was remembered
+  // before, with the number of pulses at that time in earlier_pulses.
+  inline bool visit_loop_table(LoopTable& table, uint64_t fingerprint, uint64_t pulses,
+                               uint64_t& earlier_pulses)
+  {
+    if (fingerprint > table.limit)
+    {
+      return false;
+    }
+    return _visit_distinguished(table, fingerprint, pulses, earlier_pulses);
+  }
+} // namespace snaperz
@@ -0,0 +1,202 @@
+#pragma once
+
+// Checking for loops in between pulses slows down the simulation of a single
+// extender, which only uses a single core. Instead, the simulation can hand
+// the loop check to a second thread, on another core. Every
+// LOOP_CHECK_INTERVAL pulses, the simulating thread copies the state that
+// the fingerprint of the extender is computed from, see take_sample(), into
+// a ring, see snaperz_ring.h, and carries on. The second thread computes the
+// fingerprints and checks them like the check in between pulses does, see
+// snaperz_loop.h, and logs the progress of the simulation. Once two samples
+// have the same fingerprint, it stops the simulation through an atomic flag,
+// after which the loop is confirmed on the simulating thread, see
+// confirm_loop().
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#if __linux__
+#include <sched.h>
+#endif // __linux__
+
+#include "snaperz_extender.h"
+#include "snaperz_loop.h"
+#include "snaperz_ring.h"
+#include "snaperz_topology.h"
+
+namespace snaperz
+{
+  // A loop that is suspected by the second thread.
+  struct LoopCandidate
+  {
+    // The number of pulses at which the loop was noticed.
+    uint64_t pulses;
+    // A multiple of the loop length.
+    uint64_t distance;
+  };
+
+  struct _LoopSample
+  {
+    uint64_t pulses;
+    Sample sample;
+    // Whether the extender has finished, which makes this the last sample.
+    bool last;
+  };
+
+  // Samples are taken far more slowly than the second thread handles them, so
+  // the ring only fills up while that thread is descheduled.
+  typedef Ring<_LoopSample, 1024> _LoopRing;
+
+  // The CPU of the second thread: the first CPU of the placement order, see
+  // snaperz_topology.h, other than the one of the simulating thread. Returns
+  // -1 if there is none, in which case both threads would share a CPU, and
+  // loops are better checked by the simulating thread itself.
+  inline int loop_thread_cpu()
+  {
+#if __linux__
+    const int simulating_cpu = sched_getcpu();
+    for (int cpu : placement_order())
+    {
+      if (cpu != simulating_cpu)
+      {
+        return cpu;
+      }
+    }
+#endif // __linux__
+    return -1;
+  }
+
+  // Waits for the next sample after the given number of attempts to take it
+  // from the empty ring. Samples arrive every LOOP_CHECK_INTERVAL pulses, so
+  // the ring usually stays empty for a while. The second thread first yields,
+  // and then sleeps for longer and longer, up to 100 us, which is far less
+  // than it takes to fill the ring.
+  inline void _wait_for_sample(uint32_t attempts)
+  {
+    static constexpr uint32_t kYieldCount = 16;
+    if (attempts < kYieldCount)
+    {
+      std::this_thread::yield();
+      return;
+    }
+    const uint32_t shift = std::min(attempts - kYieldCount, UINT32_C(7));
+    std::this_thread::sleep_for(std::chrono::microseconds(
+      std::min(UINT32_C(1) << shift, UINT32_C(100))));
+  }
+
+  // Checks the samples of the ring for loops until the last sample, or until
+  // two samples have the same fingerprint. Returns true in the latter case,
+  // after stopping the simulating thread.
+  inline bool _check_loops(_LoopRing& ring, std::atomic<bool>& stop, SampleCheck& samples,
+                           const std::function<void(uint64_t)>& on_status,
+                           LoopCandidate& candidate)
+  {
+    _LoopSample sample;
+    uint32_t attempts = 0;
+    while (true)
+    {
+      if (!try_pop(ring, sample))
+      {
+        _wait_for_sample(attempts++);
+        continue;
+      }
+      attempts = 0;
+      if (on_status)
+      {
+        on_status(sample.pulses);
+      }
+      if (sample.last)
+      {
+        return false;
+      }
+      uint64_t distance;
+      if (check_sample(samples, sample.pulses, sample_fingerprint(sample.sample), distance))
+      {
+        candidate = { sample.pulses, distance };
+        stop.store(true, std::memory_order_relaxed);
+        return true;
+      }
+    }
+  }
+
+  // Simulates the given extender until it finishes, or until the second
+  // thread suspects a loop. Returns false in the former case, and true in
+  // the latter, with the suspected loop in candidate. The sample of the
+  // extender as it is given has already been checked.
+  template<typename C>
+  bool _simulate_until_suspected(Extender<C>& extender, uint64_t& pulses, SampleCheck& samples,
+                                 const std::function<void(uint64_t)>& on_status,
+                                 LoopCandidate& candidate)
+  {
+    _LoopRing ring;
+    std::atomic<bool> stop{ false };
+    bool suspected = false;
+    std::thread loop_thread([&, cpu = loop_thread_cpu()]()
+    {
+      pin_thread(cpu);
+      suspected = _check_loops(ring, stop, samples, on_status, candidate);
+    });
+
+    // A local copy of the number of pulses stays in a register.
+    uint64_t sample_pulses = pulses;
+    _LoopSample sample;
+    do
+    {
+      const uint64_t next_sample_pulses = sample_pulses + LOOP_CHECK_INTERVAL;
+      while (sample_pulses != next_sample_pulses && !finished(extender))
+      {
+        simulate_pulse(extender);
+        sample_pulses++;
+      }
+      // Only copy the state here, the second thread computes the fingerprint.
+      sample.pulses = sample_pulses;
+      take_sample(extender, sample.sample);
+      sample.last = finished(extender);
+      while (!try_push(ring, sample))
+      {
+        if (stop.load(std::memory_order_relaxed))
+        {
+          break;
+        }
+        std::this_thread::yield();
+      }
+    }
+    while (!sample.last && !stop.load(std::memory_order_relaxed));
+    pulses = sample_pulses;
+
+    loop_thread.join();
+    return suspected && !finished(extender);
+  }
+
+  // Simulates the given extender until it finishes or loops, while a second
+  // thread checks the samples of the extender in the given way. Returns true
+  // if it loops, like simulate_with_loop_check(), which reports the same
+  // loop. The given function is called on the second thread with the number
+  // of pulses of every sample.
+  template<typename C>
+  bool simulate_with_loop_thread(Extender<C>& extender, uint64_t& pulses, LoopCheck check,
+                                 const std::function<void(uint64_t)>& on_status, Loop& loop)
+  {
+    // Samples are taken from the initial state on, which is checked here.
+    // They are kept when the fingerprints collide, like in between pulses.
+    SampleCheck samples = create_sample_check(check);
+    uint64_t distance;
+    if (check != LoopCheck::kNone)
+    {
+      check_sample(samples, pulses, fingerprint(extender), distance);
+    }
+    LoopCandidate candidate;
+    bool looped = false;
+    while (!looped &&
+           _simulate_until_suspected(extender, pulses, samples, on_status, candidate))
+    {
+      // The extender has moved on since the sample, but it is still in the
+      // loop, unless the fingerprints collided.
+      looped = confirm_loop(extender, candidate.pulses, candidate.distance, loop);
+    }
+    destroy_sample_check(samples);
+    return looped;
+  }
+} // namespace snaperz
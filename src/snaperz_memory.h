@@ -0,0 +1,109 @@
+#pragma once
+
+// The segments of long extenders are streamed through on every pulse, so
+// large arrays are allocated in huge pages where possible, which avoids most
+// of the TLB misses. Explicit huge pages are used if any are reserved, e.g.
+// through /proc/sys/vm/nr_hugepages, and transparent huge pages otherwise.
+//
+// Memory is placed on the NUMA node of the thread that touches it first.
+// Every array is initialized by the thread that creates it, which is the
+// thread that simulates it, so it ends up on the node of that thread, as long
+// as the thread stays on that node, see snaperz_topology.h.
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#if __linux__
+#include <sys/mman.h>
+#endif // __linux__
+
+namespace snaperz
+{
+  static constexpr size_t kCacheLineSize = 64;
+  static constexpr size_t kHugePageSize = size_t(2) << 20;
+  // Smaller arrays are not worth a huge page. With normal pages, the first
+  // level TLB covers roughly this much memory.
+  static constexpr size_t kHugePageThreshold = size_t(256) << 10;
+
+  inline size_t _round_up(size_t size, size_t alignment)
+  {
+    return (size + alignment - 1) / alignment * alignment;
+  }
+
+#if __linux__
+  inline void* _allocate_huge(size_t size)
+  {
+#ifdef MAP_HUGETLB
+    void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (memory != MAP_FAILED)
+    {
+      return memory;
+    }
+#endif // MAP_HUGETLB
+    // Transparent huge pages only back aligned ranges, so map an extra page
+    // and unmap the unaligned ends.
+    void* mapping = mmap(nullptr, size + kHugePageSize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapping == MAP_FAILED)
+    {
+      throw std::bad_alloc();
+    }
+    const uintptr_t begin = reinterpret_cast<uintptr_t>(mapping);
+    const uintptr_t aligned = _round_up(begin, kHugePageSize);
+    if (aligned != begin)
+    {
+      munmap(mapping, aligned - begin);
+    }
+    munmap(reinterpret_cast<void*>(aligned + size), begin + kHugePageSize - aligned);
+#ifdef MADV_HUGEPAGE
+    madvise(reinterpret_cast<void*>(aligned), size, MADV_HUGEPAGE);
+#endif // MADV_HUGEPAGE
+    return reinterpret_cast<void*>(aligned);
+  }
+#endif // __linux__
+
+  // Allocates an uninitialized array of the given number of elements, which
+  // is aligned to at least a cache line. The array must be released through
+  // deallocate(), with the same number of elements.
+  template<typename T>
+  inline T* allocate(size_t count)
+  {
+    static_assert(alignof(T) <= kCacheLineSize, "Type is over-aligned");
+    const size_t size = count * sizeof(T);
+#if __linux__
+    if (size >= kHugePageThreshold)
+    {
+      return static_cast<T*>(_allocate_huge(_round_up(size, kHugePageSize)));
+    }
+#endif // __linux__
+    // Note: the size of aligned allocations must be a multiple of the
+    // alignment.
+    void* memory =
+      std::aligned_alloc(kCacheLineSize, _round_up(std::max<size_t>(size, 1), kCacheLineSize));
+    if (memory == nullptr)
+    {
+      throw std::bad_alloc();
+    }
+    return static_cast<T*>(memory);
+  }
+
+  template<typename T>
+  inline void deallocate(T* memory, size_t count)
+  {
+    if (memory == nullptr)
+    {
+      return;
+    }
+#if __linux__
+    const size_t size = count * sizeof(T);
+    if (size >= kHugePageThreshold)
+    {
+      munmap(memory, _round_up(size, kHugePageSize));
+      return;
+    }
+#endif // __linux__
+    std::free(memory);
+  }
+} // namespace snaperz
@@ -0,0 +1,52 @@
+#pragma once
+
+// A bounded queue between a single producer thread and a single consumer
+// thread. Neither side ever takes a lock: the producer only writes the tail,
+// the consumer only writes the head, and each of them lives on its own cache
+// line, so the threads only share a cache line when the queue is (nearly)
+// empty or full.
+#include <atomic>
+#include <cstdint>
+
+namespace snaperz
+{
+  template<typename T, uint32_t kCapacity>
+  struct Ring
+  {
+    // The number of items ever popped, written by the consumer.
+    alignas(64) std::atomic<uint64_t> head{ 0 };
+    // The number of items ever pushed, written by the producer.
+    alignas(64) std::atomic<uint64_t> tail{ 0 };
+    alignas(64) T items[kCapacity];
+  };
+
+  // Appends the given item, from the producer thread. Returns false if the
+  // ring is full.
+  template<typename T, uint32_t kCapacity>
+  inline bool try_push(Ring<T, kCapacity>& ring, const T& item)
+  {
+    const uint64_t tail = ring.tail.load(std::memory_order_relaxed);
+    if (tail - ring.head.load(std::memory_order_acquire) == kCapacity)
+    {
+      return false;
+    }
+    ring.items[tail % kCapacity] = item;
+    ring.tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Removes the oldest item, from the consumer thread. Returns false if the
+  // ring is empty.
+  template<typename T, uint32_t kCapacity>
+  inline bool try_pop(Ring<T, kCapacity>& ring, T& item)
+  {
+    const uint64_t head = ring.head.load(std::memory_order_relaxed);
+    if (head == ring.tail.load(std::memory_order_acquire))
+    {
+      return false;
+    }
+    item = ring.items[head % kCapacity];
+    ring.head.store(head + 1, std::memory_order_release);
+    return true;
+  }
+} // namespace snaperz
@@ -0,0 +1,245 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <vector>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <cstdlib>
+#include <utility>
+
+#include "snaperz_extender.h"
+#include "snaperz_topology.h"
+
+// A sweep simulates many extenders with different lengths and periods in a
+// single run, rather than the single extender configured in constants.h.
+// Since the configuration is only known at runtime, the sweep engines are
+// separate from the extender engines.
+
+namespace snaperz
+{
+  // The configuration of a single extender in a sweep.
+  struct SweepJob
+  {
+    uint32_t length;
+    uint32_t period;
+  };
+
+  struct SweepResult
+  {
+    SweepJob job;
+    // Whether a loop was found, rather than the extender finishing.
+    bool loop;
+    // The number of pulses until the extender finished, or until the loop was
+    // found. Unlike a single extender, loops are checked by a second extender
+    // at half speed, which needs no snapshots, and therefore fits in a lane.
+    uint64_t pulses;
+  };
+
+  // The push limits of an extender with the given period, see constants.h.
+  // Shorter periods than kMinValidPeriod have no push limit.
+  inline uint32_t push_limit(uint32_t period)
+  {
+    assert(period >= kMinValidPeriod);
+    return std::min(kHardPushLimit, period / 4 - 2);
+  }
+
+  inline uint32_t last_push_limit(uint32_t period)
+  {
+    return std::min(push_limit(period) + 1, kHardPushLimit);
+  }
+
+  // Takes the next job of a sweep. Returns false once there are no jobs left.
+  typedef std::function<bool(SweepJob&)> NextJob;
+
+  // Simulates every job on several threads. Unlike sweep(), every job is
+  // simulated, even if another job behaves identically.
+  inline void _sweep(const std::vector<SweepJob>& jobs,
+                     const std::function<void(const SweepResult&)>& on_result);
+
+  // Simulates a list of jobs, and reports every result as soon as it is known.
+  typedef std::function<void(const std::vector<SweepJob>&,
+                             const std::function<void(const SweepResult&)>&)> SweepRunner;
+
+  // Simulates every job, and reports every result as soon as it is known.
+  // The results are therefore not necessarily in the same order as the jobs.
+  // The jobs are simulated by one thread for every core, or by the number of
+  // threads in $SNAPERZ_THREADS. The results are reported one at a time.
+  //
+  // The jobs that behave identically are only simulated once, by the given
+  // runner, e.g. to hand them to other processes instead.
+  inline void sweep(const std::vector<SweepJob>& jobs,
+                    const std::function<void(const SweepResult&)>& on_result,
+                    const SweepRunner& runner = _sweep);
+
+  // Simulates the jobs of a single thread with one of the engines below.
+  // Every job must be at most max_length long.
+  inline void _sweep_thread(uint32_t max_length, const NextJob& next_job,
+                            const std::function<void(const SweepResult&)>& on_result);
+}
+
+#include "snaperz_sweep_queue.h"
+#include "snaperz_sweep_cost.h"
+
+#include "snaperz_sweep_fallback.h"
+#include "snaperz_sweep_bitslice.h"
+#if SNAPERZ_X86
+#include "snaperz_sweep_avx2.h"
+#endif // SNAPERZ_X86
+
+namespace snaperz
+{
+  inline void sweep(const std::vector<SweepJob>& jobs,
+                    const std::function<void(const SweepResult&)>& on_result,
+                    const SweepRunner& runner)
+  {
+    // The period only affects the simulation through the push limits, and
+    // the last push limit only depends on the push limit. Jobs with the same
+    // length and push limit therefore have the same result, e.g. the periods
+    // 12 to 15, so only the first of them is simulated.
+    std::map<std::pair<uint32_t, uint32_t>, size_t> classes;
+    std::vector<SweepJob> unique_jobs;
+    std::vector<std::vector<SweepJob>> class_jobs;
+    for (const SweepJob& job : jobs)
+    {
+      const auto key = std::make_pair(job.length, push_limit(job.period));
+      const auto [it, inserted] = classes.emplace(key, unique_jobs.size());
+      if (inserted)
+      {
+        unique_jobs.push_back(job);
+        class_jobs.emplace_back();
+      }
+      class_jobs[it->second].push_back(job);
+    }
+    // Take the jobs that are expected to take the longest first, see
+    // snaperz_sweep_cost.h.
+    const SweepCostModel model = load_cost_model();
+    std::vector<std::pair<double, size_t>> costs;
+    for (size_t i = 0; i < unique_jobs.size(); i++)
+    {
+      costs.emplace_back(-predict_cost(model, unique_jobs[i]), i);
+    }
+    std::sort(costs.begin(), costs.end());
+    std::vector<SweepJob> ordered_jobs;
+    for (const auto& [cost, i] : costs)
+    {
+      ordered_jobs.push_back(unique_jobs[i]);
+    }
+    runner(ordered_jobs, [&](const SweepResult& result)
+    {
+      record_cost(model, result);
+      const auto key = std::make_pair(result.job.length, push_limit(result.job.period));
+      for (const SweepJob& job : class_jobs[classes.at(key)])
+      {
+        on_result({ job, result.loop, result.pulses });
+      }
+    });
+  }
+
+  inline uint32_t _thread_count()
+  {
+    if (const char* threads = std::getenv("SNAPERZ_THREADS"))
+    {
+      return std::max(1, std::atoi(threads));
+    }
+    // Use every CPU that this process may run on.
+    if (const size_t cpu_count = placement_order().size())
+    {
+      return static_cast<uint32_t>(cpu_count);
+    }
+    return std::max(1u, std::thread::hardware_concurrency());
+  }
+
+  // Pins the given thread of a sweep to its CPU, see snaperz_topology.h.
+  inline void _place_thread(const std::vector<int>& cpus, uint32_t thread)
+  {
+    if (!cpus.empty())
+    {
+      pin_thread(cpus[thread % cpus.size()]);
+    }
+  }
+
+  inline void _sweep(const std::vector<SweepJob>& jobs,
+                     const std::function<void(const SweepResult&)>& on_result)
+  {
+    uint32_t max_length = 0;
+    for (const SweepJob& job : jobs)
+    {
+      max_length = std::max(max_length, job.length);
+    }
+    // Do not start more threads than there are jobs.
+    const uint32_t thread_count = static_cast<uint32_t>(
+      std::min<size_t>(_thread_count(), std::max<size_t>(jobs.size(), 1)));
+    SweepQueue queue = create_queue(jobs, thread_count);
+    std::mutex result_mutex;
+    const auto on_thread_result = [&](const SweepResult& result)
+    {
+      std::lock_guard<std::mutex> lock(result_mutex);
+      on_result(result);
+    };
+    const std::vector<int> cpus = placement_order();
+    std::vector<std::thread> threads;
+    for (uint32_t thread = 0; thread < thread_count; thread++)
+    {
+      threads.emplace_back([&, thread]()
+      {
+        // Pin the thread before it allocates its memory, which places the
+        // memory on the node of the thread.
+        _place_thread(cpus, thread);
+        _sweep_thread(max_length, [&](SweepJob& job) { return pop_job(queue, thread, job); },
+                      on_thread_result);
+      });
+    }
+    for (std::thread& thread : threads)
+    {
+      thread.join();
+    }
+  }
+
+  inline void _sweep_thread(uint32_t max_length, const NextJob& next_job,
+                            const std::function<void(const SweepResult&)>& on_result)
+  {
+#if SNAPERZ_X86
+    // Use the smallest lanes that fit every job, which simulates the most
+    // extenders per instruction.
+    if (__builtin_cpu_supports("avx2"))
+    {
+      if (max_length + 1 <= std::numeric_limits<uint8_t>::max())
+      {
+        sweep_avx2::sweep<uint8_t>(max_length, next_job, on_result);
+        return;
+      }
+      if (max_length + 1 <= std::numeric_limits<uint16_t>::max())
+      {
+        sweep_avx2::sweep<uint16_t>(max_length, next_job, on_result);
+        return;
+      }
+    }
+#endif // SNAPERZ_X86
+    // Otherwise, use the bit-sliced implementation for short extenders, with
+    // as few bits as possible.
+    switch (32 - __builtin_clz(max_length + 1))
+    {
+    case 1:
+    case 2:
+    case 3:
+      sweep_bitslice::sweep<3>(max_length, next_job, on_result);
+      return;
+    case 4:
+      sweep_bitslice::sweep<4>(max_length, next_job, on_result);
+      return;
+    case 5:
+      sweep_bitslice::sweep<5>(max_length, next_job, on_result);
+      return;
+    case 6:
+      sweep_bitslice::sweep<6>(max_length, next_job, on_result);
+      return;
+    default:
+      sweep_fallback::sweep(max_length, next_job, on_result);
+      return;
+    }
+  }
+} // namespace snaperz
@@ -0,0 +1,393 @@
+#pragma once
+
+#if SNAPERZ_X86
+// This implementation simulates a different extender in every lane of the
+// AVX2 registers, rather than different segments of the same extender. The
+// segments are stored transposed, i.e. the i-th row contains the i-th segment
+// of every extender, and every lane has its own push limits and length.
+//
+// Every extender is simulated the same way as by the fallback implementation
+// of the extender, where a pulse passes through the segments one by one. The
+// pulse ends once every lane has passed its last segment, so the pulse takes
+// as long as the slowest lane.
+//
+// Once the extender of a lane finishes or loops, the lane is refilled with the
+// next job, so the lanes stay busy until the jobs run out.
+//
+// Within a pulse, every segment depends on the previous one, so a single
+// register only gives the CPU a long chain of dependent instructions. Every
+// row therefore consists of several registers, whose chains are independent.
+#include <immintrin.h>
+#include <cstdlib>
+#include <cstring>
+#include <cassert>
+#include <vector>
+#include <functional>
+
+#include "constants.h"
+#include "snaperz_memory.h"
+
+// Compile this engine for AVX2 regardless of the flags used for the rest
+// of the program. The engine is only selected if the CPU supports it, see
+// snaperz_sweep.h.
+#pragma GCC push_options
+#pragma GCC target("avx2")
+
+namespace snaperz::sweep_avx2
+{
+  template<typename T>
+  static constexpr uint32_t kLaneCount = sizeof(__m256i) / sizeof(T);
+  static constexpr uint32_t kVectorCount = 2;
+  // The number of extenders in every row.
+  template<typename T>
+  static constexpr uint32_t kRowLength = kVectorCount * kLaneCount<T>;
+  static_assert(kVectorCount * sizeof(__m256i) <= sizeof(uint64_t) * 8,
+                "The byte masks of a row must fit into 64 bits");
+
+  template<typename T>
+  struct _Batch
+  {
+    // The number of rows, i.e. the length of the longest extender plus two.
+    // See the fallback implementation of the extender.
+    uint32_t seg_count;
+    // The segments of the extenders, and of the slower extenders used for
+    // checking loops, one row after the other.
+    T* segments;
+    T* slow_segments;
+    // The configuration of the extender in every lane.
+    T* push_limits;
+    T* last_push_limits;
+    T* len_plus_ones;
+    // All ones for every lane that currently has no extender.
+    T* idle_masks;
+    // The job simulated by every lane, and the pulse at which it started.
+    SweepJob jobs[kRowLength<T>];
+    uint64_t starts[kRowLength<T>];
+  };
+
+  template<typename T>
+  __m256i _broadcast(uint32_t value);
+
+  template<typename T>
+  __m256i _equal_mask(const __m256i& _lhs, const __m256i& _rhs);
+
+  template<typename T>
+  void _simulate_segment(__m256i& _curr, __m256i& _next, __m256i& _counter, __m256i& _settled_mask,
+                         const __m256i& _push_limit, const __m256i& _last_push_limit,
+                         const __m256i& _len_plus_one);
+
+  /* uint8_t implementation for AVX2 */
+
+  template<>
+  inline __m256i _broadcast<uint8_t>(uint32_t value)
+  {
+    return _mm256_set1_epi8(static_cast<char>(value));
+  }
+
+  template<>
+  inline __m256i _equal_mask<uint8_t>(const __m256i& _lhs, const __m256i& _rhs)
+  {
+    return _mm256_cmpeq_epi8(_lhs, _rhs);
+  }
+
+  template<>
+  inline void _simulate_segment<uint8_t>(__m256i& _curr, __m256i& _next, __m256i& _counter, __m256i& _settled_mask,
+                                         const __m256i& _push_limit, const __m256i& _last_push_limit,
+                                         const __m256i& _len_plus_one)
+  {
+    // This follows _simulate_pair of the AVX2 implementation of the extender,
+    // see there for details. The counter is reset at the start of every
+    // pulse, so it does not have to wrap around to the first segment.
+    const __m256i _ones = _mm256_set1_epi8(1);
+    _counter = _mm256_add_epi8(_counter, _curr);
+    __m256i _last_seg_mask = _mm256_cmpeq_epi8(_counter, _len_plus_one);
+    // Handle pushing case:
+    //   Segments of length zero and one push nothing, which the saturated
+    //   subtraction takes care of.
+    __m256i _curr_push_limit = _mm256_blendv_epi8(_push_limit, _last_push_limit, _last_seg_mask);
+    __m256i _push_delta = _mm256_min_epu8(_curr_push_limit, _mm256_subs_epu8(_curr, _ones));
+    // Handle pulling case:
+    __m256i _pull_delta = _mm256_andnot_si256(_last_seg_mask, _next);
+    _pull_delta = _mm256_and_si256(_mm256_cmpeq_epi8(_curr, _ones), _pull_delta);
+    __m256i _delta = _mm256_sub_epi8(_pull_delta, _push_delta);
+    _curr = _mm256_add_epi8(_curr, _delta);
+    _next = _mm256_sub_epi8(_next, _delta);
+    _counter = _mm256_add_epi8(_counter, _delta);
+    // Once the counter is kLength + 1 after the deltas are applied, every block
+    // is in this segment or before it, and the pulse is done with the lane.
+    _last_seg_mask = _mm256_cmpeq_epi8(_counter, _len_plus_one);
+    _counter = _mm256_andnot_si256(_last_seg_mask, _counter);
+    _settled_mask = _mm256_or_si256(_settled_mask, _last_seg_mask);
+  }
+
+  /* uint16_t implementation for AVX2 */
+
+  template<>
+  inline __m256i _broadcast<uint16_t>(uint32_t value)
+  {
+    return _mm256_set1_epi16(static_cast<short>(value));
+  }
+
+  template<>
+  inline __m256i _equal_mask<uint16_t>(const __m256i& _lhs, const __m256i& _rhs)
+  {
+    return _mm256_cmpeq_epi16(_lhs, _rhs);
+  }
+
+  template<>
+  inline void _simulate_segment<uint16_t>(__m256i& _curr, __m256i& _next, __m256i& _counter, __m256i& _settled_mask,
+                                          const __m256i& _push_limit, const __m256i& _last_push_limit,
+                                          const __m256i& _len_plus_one)
+  {
+    // See uint8_t version for implementation details.
+    const __m256i _ones = _mm256_set1_epi16(1);
+    _counter = _mm256_add_epi16(_counter, _curr);
+    __m256i _last_seg_mask = _mm256_cmpeq_epi16(_counter, _len_plus_one);
+    // Handle pushing case:
+    __m256i _curr_push_limit = _mm256_blendv_epi8(_push_limit, _last_push_limit, _last_seg_mask);
+    __m256i _push_delta = _mm256_min_epu16(_curr_push_limit, _mm256_subs_epu16(_curr, _ones));
+    // Handle pulling case:
+    __m256i _pull_delta = _mm256_andnot_si256(_last_seg_mask, _next);
+    _pull_delta = _mm256_and_si256(_mm256_cmpeq_epi16(_curr, _ones), _pull_delta);
+    __m256i _delta = _mm256_sub_epi16(_pull_delta, _push_delta);
+    _curr = _mm256_add_epi16(_curr, _delta);
+    _next = _mm256_sub_epi16(_next, _delta);
+    _counter = _mm256_add_epi16(_counter, _delta);
+    _last_seg_mask = _mm256_cmpeq_epi16(_counter, _len_plus_one);
+    _counter = _mm256_andnot_si256(_last_seg_mask, _counter);
+    _settled_mask = _mm256_or_si256(_settled_mask, _last_seg_mask);
+  }
+
+  inline __m256i _load(const void* address)
+  {
+    return _mm256_load_si256(static_cast<const __m256i*>(address));
+  }
+
+  inline void _store(void* address, const __m256i& _value)
+  {
+    _mm256_store_si256(static_cast<__m256i*>(address), _value);
+  }
+
+  // Computes the byte mask of a row, i.e. the highest bit of every byte.
+  inline uint64_t _row_mask(const __m256i (&_masks)[kVectorCount])
+  {
+    uint64_t mask = 0;
+    for (uint32_t v = 0; v < kVectorCount; v++)
+    {
+      mask |= static_cast<uint64_t>(static_cast<uint32_t>(_mm256_movemask_epi8(_masks[v]))) << (32 * v);
+    }
+    return mask;
+  }
+
+  template<typename T>
+  inline void _simulate_pulse(const _Batch<T>& batch, T* segments)
+  {
+    static constexpr uint32_t kRowLength = sweep_avx2::kRowLength<T>;
+    __m256i _push_limits[kVectorCount];
+    __m256i _last_push_limits[kVectorCount];
+    __m256i _len_plus_ones[kVectorCount];
+    __m256i _settled_masks[kVectorCount];
+    __m256i _counters[kVectorCount];
+    __m256i _currs[kVectorCount];
+    for (uint32_t v = 0; v < kVectorCount; v++)
+    {
+      const uint32_t offset = v * kLaneCount<T>;
+      _push_limits[v] = _load(batch.push_limits + offset);
+      _last_push_limits[v] = _load(batch.last_push_limits + offset);
+      _len_plus_ones[v] = _load(batch.len_plus_ones + offset);
+      // Idle lanes are never simulated, so they are considered done from the
+      // start.
+      _settled_masks[v] = _load(batch.idle_masks + offset);
+      _counters[v] = _mm256_setzero_si256();
+      _currs[v] = _load(segments + offset);
+    }
+    for (uint32_t i = 0; ; i++)
+    {
+      // Every lane has passed its last segment at the second to last row.
+      assert(i + 1 < batch.seg_count);
+      __m256i _all_settled_mask = _mm256_set1_epi8(-1);
+      for (uint32_t v = 0; v < kVectorCount; v++)
+      {
+        T* row = segments + i * kRowLength + v * kLaneCount<T>;
+        __m256i _next = _load(row + kRowLength);
+        _simulate_segment<T>(_currs[v], _next, _counters[v], _settled_masks[v],
+                             _push_limits[v], _last_push_limits[v], _len_plus_ones[v]);
+        _store(row, _currs[v]);
+        _currs[v] = _next;
+        _all_settled_mask = _mm256_and_si256(_all_settled_mask, _settled_masks[v]);
+      }
+      if (_mm256_movemask_epi8(_all_settled_mask) == -1)
+      {
+        for (uint32_t v = 0; v < kVectorCount; v++)
+        {
+          _store(segments + (i + 1) * kRowLength + v * kLaneCount<T>, _currs[v]);
+        }
+        return;
+      }
+    }
+  }
+
+  // Returns the lanes where every segment of both extenders are equal, as a
+  // mask of bytes.
+  template<typename T>
+  inline uint64_t _equal_lanes(const _Batch<T>& batch)
+  {
+    static constexpr uint32_t kRowLength = sweep_avx2::kRowLength<T>;
+    __m256i _equal[kVectorCount];
+    for (uint32_t v = 0; v < kVectorCount; v++)
+    {
+      _equal[v] = _mm256_set1_epi8(-1);
+    }
+    for (uint32_t i = 0; i < batch.seg_count; i++)
+    {
+      for (uint32_t v = 0; v < kVectorCount; v++)
+      {
+        const uint32_t offset = i * kRowLength + v * kLaneCount<T>;
+        _equal[v] = _mm256_and_si256(_equal[v], _equal_mask<T>(
+          _load(batch.segments + offset),
+          _load(batch.slow_segments + offset)
+        ));
+      }
+    }
+    return _row_mask(_equal);
+  }
+
+  template<typename T>
+  inline void _fill_lane(_Batch<T>& batch, uint32_t lane, const SweepJob& job)
+  {
+    // Initialize the extender to the extended state, see create() of the
+    // extender implementations.
+    static constexpr uint32_t kRowLength = sweep_avx2::kRowLength<T>;
+    for (uint32_t i = 0; i < batch.seg_count; i++)
+    {
+      const T value = (i <= job.length) ? 1 : 0;
+      batch.segments[i * kRowLength + lane] = value;
+      batch.slow_segments[i * kRowLength + lane] = value;
+    }
+    batch.push_limits[lane] = static_cast<T>(push_limit(job.period));
+    batch.last_push_limits[lane] = static_cast<T>(last_push_limit(job.period));
+    batch.len_plus_ones[lane] = static_cast<T>(job.length + 1);
+    batch.idle_masks[lane] = 0;
+  }
+
+  template<typename T>
+  inline void sweep(uint32_t max_length, const NextJob& next_job,
+                    const std::function<void(const SweepResult&)>& on_result)
+  {
+    static constexpr uint32_t kRowLength = sweep_avx2::kRowLength<T>;
+    // Lanes of byte masks, see _row_mask.
+    static constexpr uint64_t kLaneMask = (UINT64_C(1) << sizeof(T)) - 1;
+    _Batch<T> batch;
+    batch.seg_count = max_length + 2;
+    batch.segments = allocate<T>(batch.seg_count * kRowLength);
+    batch.slow_segments = allocate<T>(batch.seg_count * kRowLength);
+    batch.push_limits = allocate<T>(kRowLength);
+    batch.last_push_limits = allocate<T>(kRowLength);
+    batch.len_plus_ones = allocate<T>(kRowLength);
+    batch.idle_masks = allocate<T>(kRowLength);
+    std::memset(batch.segments, 0, batch.seg_count * kRowLength * sizeof(T));
+    std::memset(batch.slow_segments, 0, batch.seg_count * kRowLength * sizeof(T));
+    std::memset(batch.push_limits, 0, kRowLength * sizeof(T));
+    std::memset(batch.last_push_limits, 0, kRowLength * sizeof(T));
+    std::memset(batch.len_plus_ones, 0, kRowLength * sizeof(T));
+    std::memset(batch.idle_masks, 0xFF, kRowLength * sizeof(T));
+
+    bool jobs_left = true;
+    uint32_t active_count = 0;
+    uint64_t pulses = 0;
+    while (true)
+    {
+      // Only start new jobs at even pulses. The slower extenders of every lane
+      // then pulse at the same time, which is every other pulse of the lane.
+      // Without any active lanes, simply skip ahead to the next even pulse.
+      if (active_count == 0)
+      {
+        pulses += pulses & 0x1;
+      }
+      if ((pulses & 0x1) == 0)
+      {
+        for (uint32_t lane = 0; lane < kRowLength && jobs_left; lane++)
+        {
+          if (batch.idle_masks[lane] == 0)
+          {
+            continue;
+          }
+          // Once there are no jobs left, there never will be.
+          jobs_left = next_job(batch.jobs[lane]);
+          if (jobs_left)
+          {
+            _fill_lane(batch, lane, batch.jobs[lane]);
+            batch.starts[lane] = pulses;
+            active_count++;
+          }
+        }
+      }
+      if (active_count == 0)
+      {
+        break;
+      }
+
+      // Follows simulate_extender in main.cpp, so the results are identical.
+      _simulate_pulse(batch, batch.segments);
+      pulses++;
+      __m256i _idle_masks[kVectorCount];
+      __m256i _finished_masks[kVectorCount];
+      for (uint32_t v = 0; v < kVectorCount; v++)
+      {
+        const uint32_t offset = v * kLaneCount<T>;
+        _idle_masks[v] = _load(batch.idle_masks + offset);
+        _finished_masks[v] = _equal_mask<T>(_load(batch.segments + offset),
+                                            _load(batch.len_plus_ones + offset));
+      }
+      const uint64_t active_lanes = ~_row_mask(_idle_masks);
+      const uint64_t finished_lanes = _row_mask(_finished_masks) & active_lanes;
+      uint64_t loop_lanes = 0;
+#if CHECK_LOOP
+      if ((pulses & 0x1) == 0)
+      {
+        _simulate_pulse(batch, batch.slow_segments);
+      }
+#if FAST_LOOP_DETECTION
+      loop_lanes = _equal_lanes(batch);
+#else // FAST_LOOP_DETECTION
+      if ((pulses & 0x1) == 0)
+      {
+        loop_lanes = _equal_lanes(batch);
+      }
+#endif // !FAST_LOOP_DETECTION
+      loop_lanes &= active_lanes;
+#endif // CHECK_LOOP
+      if ((finished_lanes | loop_lanes) == 0)
+      {
+        continue;
+      }
+      // Retire the lanes that are done, which makes them available for the
+      // next jobs.
+      for (uint32_t lane = 0; lane < kRowLength; lane++)
+      {
+        const uint64_t mask = kLaneMask << (lane * sizeof(T));
+        if (((finished_lanes | loop_lanes) & mask) == 0)
+        {
+          continue;
+        }
+        const bool loop = (loop_lanes & mask) != 0;
+        on_result({ batch.jobs[lane], loop, pulses - batch.starts[lane] });
+        batch.idle_masks[lane] = static_cast<T>(-1);
+        active_count--;
+      }
+    }
+
+    deallocate(batch.segments, batch.seg_count * kRowLength);
+    deallocate(batch.slow_segments, batch.seg_count * kRowLength);
+    deallocate(batch.push_limits, kRowLength);
+    deallocate(batch.last_push_limits, kRowLength);
+    deallocate(batch.len_plus_ones, kRowLength);
+    deallocate(batch.idle_masks, kRowLength);
+  }
+} // namespace snaperz::sweep_avx2
+
+#pragma GCC pop_options
+#else // SNAPERZ_X86
+// There is a bug in snaperz_sweep.h if this happens.
+#error "Requires an x86 target."
+#endif // !SNAPERZ_X86
@@ -0,0 +1,390 @@
+#pragma once
+
+// This implementation simulates 64 extenders at the same time, where bit i
+// of every word belongs to the i-th extender. Every segment length is stored
+// as kBits words, where the b-th word holds bit b of the length of that
+// segment in every extender (i.e. the segments are bit-sliced). The rules of
+// a pulse then become boolean circuits, such as ripple-carry adders, which are
+// evaluated for all extenders at once with plain 64-bit integers.
+//
+// The work per segment grows with the number of bits, so this is intended for
+// short extenders, where every length only takes a few bits. Otherwise, this
+// follows the AVX2 implementation of the sweep.
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <cassert>
+#include <vector>
+#include <functional>
+
+#include "constants.h"
+#include "snaperz_memory.h"
+
+namespace snaperz::sweep_bitslice
+{
+  static constexpr uint32_t kLaneCount = 64;
+  // Every pulse costs the same regardless of the number of active lanes, and
+  // is roughly as expensive as simulating 20 extenders with the fallback
+  // implementation. Once no lanes can be refilled, and only this many lanes
+  // are active, their extenders are continued by the fallback implementation.
+  static constexpr uint32_t kFallbackLaneCount = 16;
+
+  // A bit-sliced number of every extender.
+  template<uint32_t kBits>
+  struct _Number
+  {
+    uint64_t bits[kBits];
+  };
+
+  template<uint32_t kBits>
+  struct Batch
+  {
+    // The number of segments, i.e. the length of the longest extender plus
+    // two. See the fallback implementation of the extender.
+    uint32_t seg_count;
+    // The lengths of every segment of every extender.
+    _Number<kBits>* segments;
+    // The configuration of the extender in every lane.
+    _Number<kBits> push_limits;
+    _Number<kBits> last_push_limits;
+    _Number<kBits> len_plus_ones;
+    // The lanes that currently have no extender.
+    uint64_t idle_mask;
+  };
+
+  template<uint32_t kBits>
+  inline _Number<kBits> _add(const _Number<kBits>& lhs, const _Number<kBits>& rhs)
+  {
+    // Ripple-carry adder. The results never overflow, so the last carry is
+    // simply dropped.
+    _Number<kBits> result;
+    uint64_t carry = 0;
+    for (uint32_t b = 0; b < kBits; b++)
+    {
+      const uint64_t sum = lhs.bits[b] ^ rhs.bits[b];
+      result.bits[b] = sum ^ carry;
+      carry = (lhs.bits[b] & rhs.bits[b]) | (sum & carry);
+    }
+    return result;
+  }
+
+  // Computes lhs - rhs, and the lanes where it is negative (i.e. where lhs is
+  // less than rhs).
+  template<uint32_t kBits>
+  inline _Number<kBits> _sub(const _Number<kBits>& lhs, const _Number<kBits>& rhs, uint64_t& borrow)
+  {
+    _Number<kBits> result;
+    borrow = 0;
+    for (uint32_t b = 0; b < kBits; b++)
+    {
+      const uint64_t difference = lhs.bits[b] ^ rhs.bits[b];
+      result.bits[b] = difference ^ borrow;
+      borrow = (~lhs.bits[b] & rhs.bits[b]) | (~difference & borrow);
+    }
+    return result;
+  }
+
+  template<uint32_t kBits>
+  inline _Number<kBits> _sub(const _Number<kBits>& lhs, const _Number<kBits>& rhs)
+  {
+    uint64_t borrow;
+    return _sub(lhs, rhs, borrow);
+  }
+
+  template<uint32_t kBits>
+  inline _Number<kBits> _select(uint64_t mask, const _Number<kBits>& lhs, const _Number<kBits>& rhs)
+  {
+    // Picks lhs for the lanes in the mask, and rhs otherwise.
+    _Number<kBits> result;
+    for (uint32_t b = 0; b < kBits; b++)
+    {
+      result.bits[b] = (lhs.bits[b] & mask) | (rhs.bits[b] & ~mask);
+    }
+    return result;
+  }
+
+  template<uint32_t kBits>
+  inline uint64_t _equal_mask(const _Number<kBits>& lhs, const _Number<kBits>& rhs)
+  {
+    uint64_t difference = 0;
+    for (uint32_t b = 0; b < kBits; b++)
+    {
+      difference |= lhs.bits[b] ^ rhs.bits[b];
+    }
+    return ~difference;
+  }
+
+  // Simulates the current segment, and returns its new length. The current
+  // segment then becomes the next segment, see the fallback implementation of
+  // the extender.
+  template<uint32_t kBits>
+  inline _Number<kBits> _simulate_segment(_Number<kBits>& curr, const _Number<kBits>& next,
+                                          _Number<kBits>& remaining, uint64_t& settled_mask,
+                                          const Batch<kBits>& batch)
+  {
+    // This follows the fallback implementation of the extender, which keeps
+    // track of the number of remaining blocks, rather than the number of
+    // blocks seen so far. This takes fewer circuits than the counter of the
+    // AVX2 implementation, since the segment that is left behind is also
+    // the one that is subtracted.
+    //
+    // The last segment is the one that contains all of the remaining blocks.
+    // The segments after it receive the pushed blocks, and therefore contain
+    // all of the remaining blocks as well, until nothing is pushed anymore.
+    const uint64_t last_seg_mask = _equal_mask(curr, remaining);
+    // Handle pushing case:
+    //   Compute the saturated curr - 1 by subtracting one from every segment
+    //   that is not empty. Since that is zero for segments of length one,
+    //   the higher bits tell whether the segment has length one.
+    uint64_t high_mask = 0;
+    for (uint32_t b = 1; b < kBits; b++)
+    {
+      high_mask |= curr.bits[b];
+    }
+    _Number<kBits> curr_minus_one;
+    uint64_t borrow = curr.bits[0] | high_mask;
+    for (uint32_t b = 0; b < kBits; b++)
+    {
+      curr_minus_one.bits[b] = curr.bits[b] ^ borrow;
+      borrow &= ~curr.bits[b];
+    }
+    const _Number<kBits> curr_push_limit =
+      _select(last_seg_mask, batch.last_push_limits, batch.push_limits);
+    uint64_t below_limit_mask;
+    _sub(curr_minus_one, curr_push_limit, below_limit_mask);
+    const _Number<kBits> push_delta = _select(below_limit_mask, curr_minus_one, curr_push_limit);
+    // Handle pulling case:
+    //   The single piston keeps itself and the next segment.
+    const uint64_t pull_mask = curr.bits[0] & ~high_mask & ~last_seg_mask;
+    _Number<kBits> next_plus_one;
+    uint64_t carry = ~UINT64_C(0);
+    for (uint32_t b = 0; b < kBits; b++)
+    {
+      next_plus_one.bits[b] = next.bits[b] ^ carry;
+      carry &= next.bits[b];
+    }
+    const _Number<kBits> stay = _select(pull_mask, next_plus_one, _sub(curr, push_delta));
+    remaining = _sub(remaining, stay);
+    // The pulse is done with the lane once there are no remaining blocks.
+    uint64_t non_zero_mask = 0;
+    for (uint32_t b = 0; b < kBits; b++)
+    {
+      non_zero_mask |= remaining.bits[b];
+    }
+    settled_mask |= ~non_zero_mask;
+    // The next segment is empty if it was pulled.
+    curr = _add(next, push_delta);
+    for (uint32_t b = 0; b < kBits; b++)
+    {
+      curr.bits[b] &= ~pull_mask;
+    }
+    return stay;
+  }
+
+  template<uint32_t kBits>
+  inline Batch<kBits> create(uint32_t max_length)
+  {
+    Batch<kBits> batch;
+    batch.seg_count = max_length + 2;
+    batch.segments = allocate<_Number<kBits>>(batch.seg_count);
+    std::memset(batch.segments, 0, batch.seg_count * sizeof(_Number<kBits>));
+    std::memset(&batch.push_limits, 0, sizeof(_Number<kBits>));
+    std::memset(&batch.last_push_limits, 0, sizeof(_Number<kBits>));
+    std::memset(&batch.len_plus_ones, 0, sizeof(_Number<kBits>));
+    batch.idle_mask = ~UINT64_C(0);
+    return std::move(batch);
+  }
+
+  template<uint32_t kBits>
+  inline void destroy(Batch<kBits>& batch)
+  {
+    deallocate(batch.segments, batch.seg_count);
+    batch.segments = nullptr;
+  }
+
+  template<uint32_t kBits>
+  inline void _set_lane(_Number<kBits>& number, uint32_t lane, uint32_t value)
+  {
+    for (uint32_t b = 0; b < kBits; b++)
+    {
+      number.bits[b] &= ~(UINT64_C(1) << lane);
+      number.bits[b] |= static_cast<uint64_t>((value >> b) & 0x1) << lane;
+    }
+  }
+
+  // Initializes the extender of the given lane to the extended state, see
+  // create() of the extender implementations.
+  template<uint32_t kBits>
+  inline void start(Batch<kBits>& batch, uint32_t lane, const SweepJob& job)
+  {
+    assert(job.length + 2 <= batch.seg_count);
+    assert(job.length + 1 < (UINT32_C(1) << kBits));
+    for (uint32_t i = 0; i < batch.seg_count; i++)
+    {
+      _set_lane(batch.segments[i], lane, (i <= job.length) ? 1 : 0);
+    }
+    // The push limits may not fit in kBits bits. Segments never have more
+    // than job.length + 1 blocks though, so they never push more than the
+    // largest limit that does fit.
+    static constexpr uint32_t kMaxLimit = (UINT32_C(1) << kBits) - 1;
+    _set_lane(batch.push_limits, lane, std::min(push_limit(job.period), kMaxLimit));
+    _set_lane(batch.last_push_limits, lane, std::min(last_push_limit(job.period), kMaxLimit));
+    _set_lane(batch.len_plus_ones, lane, job.length + 1);
+    batch.idle_mask &= ~(UINT64_C(1) << lane);
+  }
+
+  // Stores the segments of the extender of the given lane, as 32-bit lengths.
+  template<uint32_t kBits>
+  inline void extract(const Batch<kBits>& batch, uint32_t lane, uint32_t* segments)
+  {
+    for (uint32_t i = 0; i < batch.seg_count; i++)
+    {
+      uint32_t value = 0;
+      for (uint32_t b = 0; b < kBits; b++)
+      {
+        value |= static_cast<uint32_t>((batch.segments[i].bits[b] >> lane) & 0x1) << b;
+      }
+      segments[i] = value;
+    }
+  }
+
+  // Stops simulating the extender of the given lane.
+  template<uint32_t kBits>
+  inline void stop(Batch<kBits>& batch, uint32_t lane)
+  {
+    batch.idle_mask |= UINT64_C(1) << lane;
+  }
+
+  template<uint32_t kBits>
+  inline void simulate_pulse(Batch<kBits>& batch)
+  {
+    // See the AVX2 implementation of the sweep for details.
+    _Number<kBits>* segments = batch.segments;
+    uint64_t settled_mask = batch.idle_mask;
+    _Number<kBits> remaining = batch.len_plus_ones;
+    _Number<kBits> curr = segments[0];
+    for (uint32_t i = 0; ; i++)
+    {
+      assert(i + 1 < batch.seg_count);
+      segments[i] = _simulate_segment(curr, segments[i + 1], remaining, settled_mask, batch);
+      if (settled_mask == ~UINT64_C(0))
+      {
+        segments[i + 1] = curr;
+        return;
+      }
+    }
+  }
+
+  // Returns the lanes where the extenders contain the same segments.
+  template<uint32_t kBits>
+  inline uint64_t equals(const Batch<kBits>& lhs, const Batch<kBits>& rhs)
+  {
+    assert(lhs.seg_count == rhs.seg_count);
+    uint64_t equal_mask = ~UINT64_C(0);
+    for (uint32_t i = 0; i < lhs.seg_count; i++)
+    {
+      equal_mask &= _equal_mask(lhs.segments[i], rhs.segments[i]);
+    }
+    return equal_mask & ~lhs.idle_mask;
+  }
+
+  // Returns the lanes where the extenders are finished.
+  template<uint32_t kBits>
+  inline uint64_t finished(const Batch<kBits>& batch)
+  {
+    return _equal_mask(batch.segments[0], batch.len_plus_ones) & ~batch.idle_mask;
+  }
+
+  template<uint32_t kBits>
+  inline void sweep(uint32_t max_length, const NextJob& next_job,
+                    const std::function<void(const SweepResult&)>& on_result)
+  {
+    // See the AVX2 implementation of the sweep for details.
+    Batch<kBits> batch = create<kBits>(max_length);
+    Batch<kBits> slow_batch = create<kBits>(max_length);
+    SweepJob lane_jobs[kLaneCount];
+    uint64_t lane_starts[kLaneCount];
+
+    bool jobs_left = true;
+    uint32_t active_count = 0;
+    uint64_t pulses = 0;
+    while (true)
+    {
+      if (active_count == 0)
+      {
+        pulses += pulses & 0x1;
+      }
+      if ((pulses & 0x1) == 0)
+      {
+        for (uint32_t lane = 0; lane < kLaneCount && jobs_left; lane++)
+        {
+          if ((batch.idle_mask & (UINT64_C(1) << lane)) == 0)
+          {
+            continue;
+          }
+          jobs_left = next_job(lane_jobs[lane]);
+          if (jobs_left)
+          {
+            start(batch, lane, lane_jobs[lane]);
+            start(slow_batch, lane, lane_jobs[lane]);
+            lane_starts[lane] = pulses;
+            active_count++;
+          }
+        }
+      }
+      if (active_count == 0)
+      {
+        break;
+      }
+
+      simulate_pulse(batch);
+      pulses++;
+      const uint64_t finished_lanes = finished(batch);
+      uint64_t loop_lanes = 0;
+#if CHECK_LOOP
+      if ((pulses & 0x1) == 0)
+      {
+        simulate_pulse(slow_batch);
+      }
+#if FAST_LOOP_DETECTION
+      loop_lanes = equals(batch, slow_batch);
+#else // FAST_LOOP_DETECTION
+      if ((pulses & 0x1) == 0)
+      {
+        loop_lanes = equals(batch, slow_batch);
+      }
+#endif // !FAST_LOOP_DETECTION
+#endif // CHECK_LOOP
+      for (uint64_t done = finished_lanes | loop_lanes; done != 0; done &= done - 1)
+      {
+        const uint32_t lane = __builtin_ctzll(done);
+        const bool loop = (loop_lanes >> lane) & 0x1;
+        on_result({ lane_jobs[lane], loop, pulses - lane_starts[lane] });
+        stop(batch, lane);
+        stop(slow_batch, lane);
+        active_count--;
+      }
+      if (!jobs_left && active_count <= kFallbackLaneCount)
+      {
+        std::vector<uint32_t> extender(batch.seg_count), slow_extender(batch.seg_count);
+        for (uint64_t active = ~batch.idle_mask; active != 0; active &= active - 1)
+        {
+          const uint32_t lane = __builtin_ctzll(active);
+          const SweepJob& job = lane_jobs[lane];
+          extract(batch, lane, extender.data());
+          extract(slow_batch, lane, slow_extender.data());
+          // The fallback implementation only uses the segments of the job.
+          extender.resize(job.length + 2);
+          slow_extender.resize(job.length + 2);
+          on_result(sweep_fallback::resume(job, extender, slow_extender, pulses - lane_starts[lane]));
+          extender.resize(batch.seg_count);
+          slow_extender.resize(batch.seg_count);
+        }
+        break;
+      }
+    }
+
+    destroy(batch);
+    destroy(slow_batch);
+  }
+} // namespace snaperz::sweep_bitslice
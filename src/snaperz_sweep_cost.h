@@ -0,0 +1,140 @@
+#pragma once
+
+// The cost of a job varies wildly, and grows steeply with its length. If the
+// most expensive job of a sweep is taken last, it runs alone long after every
+// other job has finished. Sweeps therefore take the jobs that are expected
+// to take the longest first.
+//
+// The cost of a job is predicted from the results of earlier sweeps, which
+// are recorded in the cache directory, see snaperz_cache.h. The number of
+// pulses grows roughly exponentially with the length, so for every push
+// limit, the logarithm of the number of pulses is fitted to the length by
+// least squares. Every pulse takes time proportional to the length, which
+// gives the cost of the job.
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <system_error>
+#include <utility>
+
+#include "snaperz_cache.h"
+
+namespace snaperz
+{
+  // The fit of all push limits together, for push limits without a fit.
+  static constexpr uint32_t _kAnyPushLimit = UINT32_MAX;
+
+  struct SweepCostModel
+  {
+    // The recorded number of pulses for every length and push limit.
+    std::map<std::pair<uint32_t, uint32_t>, uint64_t> pulses;
+    // log(pulses) = intercept + slope * length, for every push limit.
+    struct Fit
+    {
+      double intercept;
+      double slope;
+    };
+    std::map<uint32_t, Fit> fits;
+  };
+
+  inline std::filesystem::path _history_path()
+  {
+    return cache_dir() / "sweep-history";
+  }
+
+  // Loads the results of earlier sweeps, and fits the model to them.
+  inline SweepCostModel load_cost_model()
+  {
+    SweepCostModel model;
+    std::ifstream history(_history_path());
+    uint32_t length, push;
+    uint64_t pulses;
+    while (history >> length >> push >> pulses)
+    {
+      model.pulses[{ length, push }] = pulses;
+    }
+
+    struct Sums
+    {
+      double n = 0, x = 0, y = 0, xx = 0, xy = 0;
+    };
+    std::map<uint32_t, Sums> sums;
+    for (const auto& [key, pulses] : model.pulses)
+    {
+      const double x = key.first;
+      const double y = std::log(static_cast<double>(std::max<uint64_t>(pulses, 1)));
+      for (const uint32_t push : { key.second, _kAnyPushLimit })
+      {
+        Sums& s = sums[push];
+        s.n++;
+        s.x += x;
+        s.y += y;
+        s.xx += x * x;
+        s.xy += x * y;
+      }
+    }
+    for (const auto& [push, s] : sums)
+    {
+      // A line needs at least two different lengths.
+      const double det = s.n * s.xx - s.x * s.x;
+      if (s.n < 2 || det <= 0)
+      {
+        continue;
+      }
+      const double slope = (s.n * s.xy - s.x * s.y) / det;
+      model.fits[push] = { (s.y - slope * s.x) / s.n, slope };
+    }
+    return model;
+  }
+
+  // Records the result of a job for later sweeps, unless it is known already.
+  inline void record_cost(const SweepCostModel& model, const SweepResult& result)
+  {
+    const uint32_t push = push_limit(result.job.period);
+    if (model.pulses.count({ result.job.length, push }) != 0)
+    {
+      return;
+    }
+    std::error_code error;
+    std::filesystem::create_directories(cache_dir(), error);
+    // Several sweeps can record results at the same time. Every line is
+    // appended by a single write, which keeps the lines intact.
+    const std::string line =
+      std::to_string(result.job.length) + " " + std::to_string(push) + " " +
+      std::to_string(result.pulses) + "\n";
+    std::ofstream history(_history_path(), std::ios::app);
+    history.write(line.data(), line.size());
+    history.flush();
+  }
+
+  // Predicts the time it takes to simulate the given job, in arbitrary units.
+  inline double predict_cost(const SweepCostModel& model, const SweepJob& job)
+  {
+    if (model.fits.empty())
+    {
+      // Without any history, longer jobs usually take longer.
+      return job.length;
+    }
+    const uint32_t push = push_limit(job.period);
+    double pulses;
+    const auto recorded = model.pulses.find({ job.length, push });
+    if (recorded != model.pulses.end())
+    {
+      pulses = static_cast<double>(recorded->second);
+    }
+    else
+    {
+      auto fit = model.fits.find(push);
+      if (fit == model.fits.end())
+      {
+        fit = model.fits.find(_kAnyPushLimit);
+      }
+      pulses = std::exp(fit->second.intercept + fit->second.slope * job.length);
+    }
+    return pulses * (job.length + 1);
+  }
+} // namespace snaperz
@@ -0,0 +1,352 @@
+#pragma once
+
+// A sweep can also be shared by several processes, possibly on different
+// machines, through a directory on a shared file system. The coordinator
+// writes the jobs into the directory, and workers take the jobs, simulate
+// them, and write back their results. The directory contains:
+//
+//   manifest   The jobs of the sweep, one "<length> <period>" per line, with
+//              the most expensive jobs first, see snaperz_sweep_cost.h.
+//   pending/   An empty file "<length>-<period>" for every job that has not
+//              been taken yet.
+//   claimed/   An empty file "<length>-<period>@<worker>" for every job that
+//              is being simulated.
+//   results/   A file "<length>-<period>" for every finished job, which
+//              contains "done <pulses>" or "loop <pulses>".
+//   workers/   A heartbeat file for every worker.
+//
+// Workers take the jobs in the order of the manifest. A worker takes a job by
+// renaming it from pending/ to claimed/. Renaming is atomic, so every job is
+// taken by a single worker. Results are written to a temporary file first,
+// which is then renamed as well, so a result is never read while it is being
+// written. Every worker touches its heartbeat file regularly. Once a worker
+// dies, its heartbeat gets stale, and its jobs are moved back to pending/ by
+// the coordinator, or by any of the other workers.
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+
+#include "snaperz_sweep.h"
+
+namespace snaperz::sweep_dir
+{
+  // How often every worker touches its heartbeat, and how old a heartbeat can
+  // get before its worker is considered dead. The timeout is generous, since
+  // the clocks of different machines are never quite in sync.
+  static constexpr std::chrono::seconds kHeartbeatInterval{ 10 };
+  static constexpr std::chrono::seconds kHeartbeatTimeout{ 60 };
+  // How often the coordinator checks for new results.
+  static constexpr std::chrono::seconds kPollInterval{ 1 };
+
+  inline std::string _job_name(const SweepJob& job)
+  {
+    return std::to_string(job.length) + "-" + std::to_string(job.period);
+  }
+
+  // Identifies this process among the workers on every machine.
+  inline std::string _worker_name()
+  {
+    char host[256] = "";
+    gethostname(host, sizeof(host) - 1);
+    return std::string(host) + "-" + std::to_string(getpid());
+  }
+
+  inline bool _empty(const std::filesystem::path& dir)
+  {
+    std::error_code error;
+    return std::filesystem::directory_iterator(dir, error) == std::filesystem::directory_iterator();
+  }
+
+  // Writes the given file through a temporary file, which is unique to the
+  // given writer.
+  inline bool _write_file(const std::filesystem::path& path, const std::string& contents,
+                          const std::string& writer)
+  {
+    const std::filesystem::path tmp = path.string() + ".tmp-" + writer;
+    {
+      std::ofstream file(tmp);
+      if (!(file << contents) || !file.flush())
+      {
+        return false;
+      }
+    }
+    std::error_code error;
+    std::filesystem::rename(tmp, path, error);
+    return !error;
+  }
+
+  inline bool _read_result(const std::filesystem::path& path, SweepResult& result)
+  {
+    std::ifstream file(path);
+    std::string outcome;
+    if (!(file >> outcome >> result.pulses))
+    {
+      return false;
+    }
+    result.loop = outcome == "loop";
+    return true;
+  }
+
+  // Moves the jobs of dead workers back to pending/.
+  inline void _reclaim(const std::filesystem::path& dir)
+  {
+    const auto now = std::filesystem::file_time_type::clock::now();
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(dir / "claimed", error))
+    {
+      const std::string name = entry.path().filename().string();
+      const size_t at = name.find('@');
+      if (at == std::string::npos)
+      {
+        continue;
+      }
+      std::error_code heartbeat_error;
+      const auto heartbeat = std::filesystem::last_write_time(
+        dir / "workers" / name.substr(at + 1), heartbeat_error);
+      if (heartbeat_error || now - heartbeat > kHeartbeatTimeout)
+      {
+        std::filesystem::rename(entry.path(), dir / "pending" / name.substr(0, at), heartbeat_error);
+      }
+    }
+  }
+
+  // Takes the first pending job of the manifest, starting at the given
+  // position, which is shared by the threads of this worker. Returns false if
+  // there are none left.
+  inline bool _claim(const std::filesystem::path& dir, const std::string& worker,
+                     const std::vector<SweepJob>& jobs, std::atomic<size_t>& next,
+                     SweepJob& job)
+  {
+    for (size_t i = next++; i < jobs.size(); i = next++)
+    {
+      job = jobs[i];
+      const std::string name = _job_name(job);
+      const std::filesystem::path claimed = dir / "claimed" / (name + "@" + worker);
+      std::error_code error;
+      std::filesystem::rename(dir / "pending" / name, claimed, error);
+      if (error)
+      {
+        // Taken by another worker, or finished already.
+        continue;
+      }
+      // The jobs of workers that seemed dead are put back, but the worker
+      // might have finished them after all.
+      if (std::filesystem::exists(dir / "results" / name, error))
+      {
+        std::filesystem::remove(claimed, error);
+        continue;
+      }
+      return true;
+    }
+    return false;
+  }
+
+  inline void _publish(const std::filesystem::path& dir, const std::string& worker,
+                       const SweepResult& result)
+  {
+    const std::string name = _job_name(result.job);
+    const std::string contents =
+      std::string(result.loop ? "loop " : "done ") + std::to_string(result.pulses) + "\n";
+    if (!_write_file(dir / "results" / name, contents, worker))
+    {
+      // Leave the job claimed. Once this worker is gone, it is simulated again.
+      std::cerr << "Failed to write the result of " << name << "." << std::endl;
+      return;
+    }
+    std::error_code error;
+    std::filesystem::remove(dir / "claimed" / (name + "@" + worker), error);
+  }
+
+  // Hands the jobs to the workers, and waits for their results.
+  inline void _coordinate(const std::filesystem::path& dir, const std::vector<SweepJob>& jobs,
+                          const std::function<void(const SweepResult&)>& on_result)
+  {
+    // The coordinator can be restarted, in which case the jobs that are taken
+    // or finished already are left alone.
+    std::set<std::string> claimed;
+    std::error_code error;
+    for (const auto& entry : std::filesystem::directory_iterator(dir / "claimed", error))
+    {
+      const std::string name = entry.path().filename().string();
+      claimed.insert(name.substr(0, name.find('@')));
+    }
+    std::string manifest;
+    for (const SweepJob& job : jobs)
+    {
+      const std::string name = _job_name(job);
+      manifest += std::to_string(job.length) + " " + std::to_string(job.period) + "\n";
+      if (!std::filesystem::exists(dir / "results" / name, error) &&
+          !std::filesystem::exists(dir / "pending" / name, error) &&
+          claimed.count(name) == 0)
+      {
+        std::ofstream(dir / "pending" / name);
+      }
+    }
+    // Workers only start once the manifest exists, which is therefore written
+    // after the jobs.
+    if (!_write_file(dir / "manifest", manifest, std::to_string(getpid())))
+    {
+      std::cerr << "Failed to write " << (dir / "manifest").string() << "." << std::endl;
+    }
+
+    std::vector<bool> reported(jobs.size(), false);
+    size_t report_count = 0;
+    while (true)
+    {
+      for (size_t i = 0; i < jobs.size(); i++)
+      {
+        SweepResult result = { jobs[i], false, 0 };
+        if (!reported[i] && _read_result(dir / "results" / _job_name(jobs[i]), result))
+        {
+          on_result(result);
+          reported[i] = true;
+          report_count++;
+        }
+      }
+      if (report_count == jobs.size())
+      {
+        return;
+      }
+      _reclaim(dir);
+      std::this_thread::sleep_for(kPollInterval);
+    }
+  }
+
+  // Writes the given jobs to the given directory, and reports their results
+  // once the workers have simulated them. Like sweep(), jobs that behave
+  // identically are only simulated once. Returns false if the directory can
+  // not be created.
+  inline bool coordinate(const std::filesystem::path& dir, const std::vector<SweepJob>& jobs,
+                         const std::function<void(const SweepResult&)>& on_result)
+  {
+    for (const char* subdir : { "pending", "claimed", "results", "workers" })
+    {
+      std::error_code error;
+      std::filesystem::create_directories(dir / subdir, error);
+      if (error)
+      {
+        std::cerr << "Failed to create " << (dir / subdir).string() << "." << std::endl;
+        return false;
+      }
+    }
+    sweep(jobs, on_result, [&](const std::vector<SweepJob>& unique_jobs,
+                               const std::function<void(const SweepResult&)>& on_unique_result)
+    {
+      _coordinate(dir, unique_jobs, on_unique_result);
+    });
+    return true;
+  }
+
+  // Simulates the jobs in the given directory on every core, see sweep(), and
+  // reports the results of the jobs simulated by this worker. Returns once
+  // every job is finished, or false if the directory contains no sweep.
+  inline bool work(const std::filesystem::path& dir,
+                   const std::function<void(const SweepResult&)>& on_result)
+  {
+    std::ifstream manifest(dir / "manifest");
+    if (!manifest)
+    {
+      std::cerr << "There is no sweep in " << dir.string() << "." << std::endl;
+      return false;
+    }
+    std::vector<SweepJob> jobs;
+    uint32_t max_length = 0;
+    SweepJob job;
+    while (manifest >> job.length >> job.period)
+    {
+      if (job.length == 0 || job.period < kMinValidPeriod)
+      {
+        std::cerr << "The manifest of " << dir.string() << " is invalid." << std::endl;
+        return false;
+      }
+      jobs.push_back(job);
+      max_length = std::max(max_length, job.length);
+    }
+
+    const std::string worker = _worker_name();
+    const std::filesystem::path heartbeat = dir / "workers" / worker;
+    if (!std::ofstream(heartbeat))
+    {
+      std::cerr << "Failed to create " << heartbeat.string() << "." << std::endl;
+      return false;
+    }
+    std::mutex heartbeat_mutex;
+    std::condition_variable heartbeat_stop;
+    bool stopped = false;
+    std::thread heartbeat_thread([&]()
+    {
+      std::unique_lock<std::mutex> lock(heartbeat_mutex);
+      while (!heartbeat_stop.wait_for(lock, kHeartbeatInterval, [&]() { return stopped; }))
+      {
+        std::error_code error;
+        std::filesystem::last_write_time(
+          heartbeat, std::filesystem::file_time_type::clock::now(), error);
+      }
+    });
+
+    std::mutex result_mutex;
+    const auto on_thread_result = [&](const SweepResult& result)
+    {
+      _publish(dir, worker, result);
+      std::lock_guard<std::mutex> lock(result_mutex);
+      on_result(result);
+    };
+    while (true)
+    {
+      if (!_empty(dir / "pending"))
+      {
+        // Take jobs on every thread until none are left. Unlike _sweep(), the
+        // threads take the jobs from the directory. Jobs can be put back, so
+        // every round goes through the whole manifest.
+        std::atomic<size_t> next = 0;
+        const std::vector<int> cpus = placement_order();
+        std::vector<std::thread> threads;
+        for (uint32_t thread = 0; thread < _thread_count(); thread++)
+        {
+          threads.emplace_back([&, thread]()
+          {
+            _place_thread(cpus, thread);
+            _sweep_thread(max_length,
+                          [&](SweepJob& job) { return _claim(dir, worker, jobs, next, job); },
+                          on_thread_result);
+          });
+        }
+        for (std::thread& thread : threads)
+        {
+          thread.join();
+        }
+        continue;
+      }
+      if (_empty(dir / "claimed"))
+      {
+        break;
+      }
+      // Other workers are still simulating jobs. Stay around, in case they
+      // die and their jobs have to be simulated again.
+      std::this_thread::sleep_for(kHeartbeatInterval);
+      _reclaim(dir);
+    }
+
+    {
+      std::lock_guard<std::mutex> lock(heartbeat_mutex);
+      stopped = true;
+    }
+    heartbeat_stop.notify_one();
+    heartbeat_thread.join();
+    std::error_code error;
+    std::filesystem::remove(heartbeat, error);
+    return true;
+  }
+} // namespace snaperz::sweep_dir
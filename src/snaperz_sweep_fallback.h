@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <functional>
+
+#include "constants.h"
+
+namespace snaperz::sweep_fallback
+{
+  // The fallback implementation of the extender, with the configuration
+  // passed at runtime. See snaperz_extender_fallback.h for details.
+  inline void _simulate_pulse(uint32_t* segments, uint32_t length,
+                              uint32_t push_limit, uint32_t last_push_limit)
+  {
+    uint32_t curr = segments[0];
+    uint32_t remaining = length + 1;
+    uint32_t i = 0;
+    while (curr != remaining)
+    {
+      const uint32_t next = segments[i + 1];
+      const uint32_t push_delta = std::min(push_limit, curr - (curr != 0));
+      const uint32_t single_mask = -static_cast<uint32_t>(curr == 1);
+      const uint32_t stay = curr - push_delta + (next & single_mask);
+      segments[i] = stay;
+      remaining -= stay;
+      curr = (next + push_delta) & ~single_mask;
+      i++;
+    }
+    while (curr > 1)
+    {
+      const uint32_t push_delta = std::min(last_push_limit, curr - 1);
+      segments[i++] = curr - push_delta;
+      curr = push_delta;
+    }
+    segments[i] = curr;
+  }
+
+  // Continues simulating the given extenders of the job, after the given
+  // number of pulses. Every extender has job.length + 2 segments.
+  inline SweepResult resume(const SweepJob& job, std::vector<uint32_t>& extender,
+                            std::vector<uint32_t>& slow_extender, uint64_t pulses)
+  {
+    const uint32_t limit = push_limit(job.period);
+    const uint32_t last_limit = last_push_limit(job.period);
+    // Follows simulate_extender in main.cpp, so the results are identical.
+    while (extender[0] != job.length + 1)
+    {
+      _simulate_pulse(extender.data(), job.length, limit, last_limit);
+      pulses++;
+#if CHECK_LOOP
+      if ((pulses & 0x1) == 0)
+      {
+        _simulate_pulse(slow_extender.data(), job.length, limit, last_limit);
+      }
+#if FAST_LOOP_DETECTION
+      if (extender == slow_extender)
+#else // FAST_LOOP_DETECTION
+      if ((pulses & 0x1) == 0 && extender == slow_extender)
+#endif // !FAST_LOOP_DETECTION
+      {
+        return { job, true, pulses };
+      }
+#endif // CHECK_LOOP
+    }
+    return { job, false, pulses };
+  }
+
+  inline SweepResult _simulate_job(const SweepJob& job, std::vector<uint32_t>& extender,
+                                   std::vector<uint32_t>& slow_extender)
+  {
+    // Note: leave an extra segment after the last block, as in the fallback
+    // implementation of the extender.
+    const uint32_t seg_count = job.length + 2;
+    extender.assign(seg_count, 1);
+    extender[seg_count - 1] = 0;
+    slow_extender = extender;
+    return resume(job, extender, slow_extender, 0);
+  }
+
+  inline void sweep(uint32_t max_length, const NextJob& next_job,
+                    const std::function<void(const SweepResult&)>& on_result)
+  {
+    std::vector<uint32_t> extender, slow_extender;
+    extender.reserve(max_length + 2);
+    slow_extender.reserve(max_length + 2);
+    SweepJob job;
+    while (next_job(job))
+    {
+      on_result(_simulate_job(job, extender, slow_extender));
+    }
+  }
+} // namespace snaperz::sweep_fallback
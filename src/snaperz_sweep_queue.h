@@ -0,0 +1,80 @@
+#pragma once
+
+// The jobs of a sweep are shared by several threads. The time it takes to
+// simulate a job varies wildly, from microseconds to days, so the jobs can
+// not be split evenly up front. Instead, every thread has its own deque of
+// jobs, and takes the jobs from its front. Once a thread runs out of jobs, it
+// steals the jobs of the other threads, which keeps every thread busy until
+// the last jobs are taken.
+//
+// A thread takes a single job at a time, but simulating a job takes far
+// longer than taking it, so a lock for every deque is cheap enough.
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace snaperz
+{
+  struct _SweepDeque
+  {
+    std::mutex mutex;
+    std::deque<SweepJob> jobs;
+  };
+
+  struct SweepQueue
+  {
+    // The deque of every thread.
+    std::vector<std::unique_ptr<_SweepDeque>> deques;
+  };
+
+  // Splits the given jobs over the deques of the given number of threads.
+  inline SweepQueue create_queue(const std::vector<SweepJob>& jobs, uint32_t thread_count)
+  {
+    SweepQueue queue;
+    for (uint32_t i = 0; i < thread_count; i++)
+    {
+      queue.deques.push_back(std::make_unique<_SweepDeque>());
+    }
+    // The jobs are ordered by their predicted cost, so deal them out one by
+    // one, which gives every thread a similar mix of jobs, again ordered by
+    // their cost.
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+      queue.deques[i % thread_count]->jobs.push_back(jobs[i]);
+    }
+    return queue;
+  }
+
+  // Takes the next job of the given thread, or steals one from another
+  // thread. Jobs are stolen from the front as well, so the most expensive
+  // jobs are still taken first. Returns false once every job has been taken.
+  // Since no jobs are ever added, the queue stays empty from then on.
+  inline bool pop_job(SweepQueue& queue, uint32_t thread, SweepJob& job)
+  {
+    {
+      _SweepDeque& deque = *queue.deques[thread];
+      std::lock_guard<std::mutex> lock(deque.mutex);
+      if (!deque.jobs.empty())
+      {
+        job = deque.jobs.front();
+        deque.jobs.pop_front();
+        return true;
+      }
+    }
+    const uint32_t thread_count = static_cast<uint32_t>(queue.deques.size());
+    for (uint32_t i = 1; i < thread_count; i++)
+    {
+      _SweepDeque& victim = *queue.deques[(thread + i) % thread_count];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.jobs.empty())
+      {
+        job = victim.jobs.front();
+        victim.jobs.pop_front();
+        return true;
+      }
+    }
+    return false;
+  }
+} // namespace snaperz
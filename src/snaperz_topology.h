@@ -0,0 +1,127 @@
+#pragma once
+
+// Threads are pinned to a single CPU, so that they never move away from the
+// NUMA node of their memory, see snaperz_memory.h. Sweeps place their threads
+// on separate physical cores first, spread over the NUMA nodes, and only then
+// on the SMT siblings of those cores. Sweeps with fewer threads than CPUs,
+// e.g. with $SNAPERZ_THREADS set to the number of cores, therefore never
+// share a core, while sweeps on every CPU simulate two independent batches
+// on every core, which fills the gaps in each other's pipelines.
+//
+// Pinning can be disabled by setting $SNAPERZ_PIN to 0, e.g. when several
+// programs share the machine.
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <utility>
+#include <vector>
+#if __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif // __linux__
+
+namespace snaperz
+{
+  inline bool _pinning_enabled()
+  {
+    const char* pin = std::getenv("SNAPERZ_PIN");
+    return pin == nullptr || std::atoi(pin) != 0;
+  }
+
+#if __linux__
+  inline int _read_topology(int cpu, const char* name)
+  {
+    std::ifstream file("/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/" + name);
+    int value = 0;
+    file >> value;
+    return value;
+  }
+
+  inline int _numa_node(int cpu)
+  {
+    // The node of a CPU is only given by the name of a link, e.g. "node1".
+    std::error_code error;
+    const std::filesystem::path dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+    for (const auto& entry : std::filesystem::directory_iterator(dir, error))
+    {
+      const std::string name = entry.path().filename().string();
+      if (name.size() > 4 && name.compare(0, 4, "node") == 0)
+      {
+        return std::atoi(name.c_str() + 4);
+      }
+    }
+    return 0;
+  }
+#endif // __linux__
+
+  // The CPUs that this process may run on, in the order that threads are
+  // placed on them. Empty if the topology is unknown.
+  inline std::vector<int> placement_order()
+  {
+    std::vector<int> cpus;
+#if __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+    {
+      return cpus;
+    }
+    // Sort the CPUs by their index among the siblings of their core, then by
+    // the index of their core within its node, and then by their node.
+    std::vector<std::tuple<int, int, int, int>> order;
+    std::map<std::pair<int, int>, std::pair<int, int>> cores;
+    std::map<int, int> node_core_counts;
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+      if (!CPU_ISSET(cpu, &allowed))
+      {
+        continue;
+      }
+      const int node = _numa_node(cpu);
+      const auto core = std::make_pair(_read_topology(cpu, "physical_package_id"),
+                                       _read_topology(cpu, "core_id"));
+      const auto [it, inserted] = cores.emplace(core, std::make_pair(node_core_counts[node], 0));
+      if (inserted)
+      {
+        node_core_counts[node]++;
+      }
+      auto& [core_index, sibling_count] = it->second;
+      order.emplace_back(sibling_count++, core_index, node, cpu);
+    }
+    std::sort(order.begin(), order.end());
+    for (const auto& placement : order)
+    {
+      cpus.push_back(std::get<3>(placement));
+    }
+#endif // __linux__
+    return cpus;
+  }
+
+  // Pins the calling thread to the given CPU.
+  inline void pin_thread(int cpu)
+  {
+#if __linux__
+    if (!_pinning_enabled() || cpu < 0)
+    {
+      return;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#endif // __linux__
+  }
+
+  // Pins the calling thread to the CPU it is running on.
+  inline void pin_thread()
+  {
+#if __linux__
+    pin_thread(sched_getcpu());
+#endif // __linux__
+  }
+} // namespace snaperz
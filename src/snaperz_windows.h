@@ -0,0 +1,115 @@
+#pragma once
+
+// The engines that simulate the extender in windows of segments, see
+// snaperz_extender_avx2.h, keep several pulses in flight. Their segments are
+// therefore only known once those pulses are complete, which is done here in
+// scalar code. This gives the same segments as the fallback engine after the
+// same number of pulses, regardless of the phase of the windows.
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+
+namespace snaperz
+{
+  // Simulates a single segment of a pulse, like _simulate_pair of the AVX2
+  // implementation does for every element of a pair of windows.
+  template<typename C>
+  inline void _simulate_window_segment(typename C::len_t& curr, typename C::len_t& next,
+                                       typename C::len_t& counter)
+  {
+    typedef typename C::len_t len_t;
+    counter += curr;
+    const bool last = counter == C::kLength + 1;
+    const len_t push_limit = last ? C::kLastPushLimit : C::kPushLimit;
+    const len_t push_delta = curr > 1 ? std::min<len_t>(push_limit, curr - 1) : 0;
+    const len_t pull_delta = curr == 1 && !last ? next : 0;
+    const len_t delta = pull_delta - push_delta;
+    curr += delta;
+    next -= delta;
+    counter += delta;
+    if (counter == C::kLength + 1)
+    {
+      counter = 0;
+    }
+  }
+
+  // Writes the lengths of the kLength + 1 segments of a windowed engine to
+  // the given array, as they are once every pulse simulated so far is
+  // complete. The engine has kSegs segments in a ring, kSat of which are in
+  // kWindows windows of kElems elements, which are given in the order of the
+  // AVX2 implementation, together with the counter of every pair of windows.
+  //
+  // Every step, the pairs of windows simulate one segment of several pulses,
+  // which are two segments apart, and which are at different segments of
+  // their pulses. Once the segments are collected from the windows and from
+  // memory, the pulses in the windows are completed one by one, starting
+  // with the oldest one, i.e. the one furthest along. Later pulses only
+  // follow earlier ones, so this gives the same segments as simulating the
+  // pulses one after the other.
+  template<typename C, uint32_t kSegs, uint32_t kSat, uint32_t kWindows, uint32_t kElems>
+  inline void read_window_segments(const typename C::len_t* segments, size_t p, uint64_t steps,
+                                   const typename C::len_t (&windows)[kWindows][kElems],
+                                   const typename C::len_t (&counters)[kWindows / 2][kElems],
+                                   typename C::len_t* dst)
+  {
+    typedef typename C::len_t len_t;
+
+    // Element e of window w is the segment at offset e * kWindows + w of the
+    // windows, which is kSat - offset segments before p. Until the windows
+    // are saturated, the first offsets hold no segment at all. The segments
+    // after the last one are always zero, so they are left out of dst.
+    const uint64_t first_offset = steps < kSat ? kSat - steps : 0;
+    const auto position = [&](uint32_t offset)
+    {
+      return (p + kSegs - kSat + offset) % kSegs;
+    };
+
+    std::memcpy(dst, segments, (C::kLength + 1) * sizeof(len_t));
+    for (uint32_t offset = first_offset; offset < kSat; offset++)
+    {
+      if (position(offset) <= C::kLength)
+      {
+        dst[position(offset)] = windows[offset % kWindows][offset / kWindows];
+      }
+    }
+
+    // Every current window element was the current segment of a pulse in
+    // the last step, so the pulse continues after it. Pulses that just
+    // simulated the last segment are complete.
+    struct Pulse
+    {
+      uint32_t position;
+      len_t counter;
+    };
+    // Only the current windows hold pulses.
+    Pulse pulses[kSat / 2 + 1];
+    uint32_t pulse_count = 0;
+    for (uint32_t offset = first_offset; offset < kSat; offset++)
+    {
+      const uint32_t window = offset % kWindows;
+      if (window % 2 != 0 || position(offset) >= C::kLength)
+      {
+        continue;
+      }
+      // Insert the pulse by its position, furthest along first. There are
+      // only a few pulses in the windows, and no more than the array holds.
+      const Pulse pulse = { static_cast<uint32_t>(position(offset)),
+                            counters[window / 2][offset / kWindows] };
+      uint32_t j = pulse_count++;
+      for (; j > 0 && pulses[j - 1].position < pulse.position; j--)
+      {
+        pulses[j] = pulses[j - 1];
+      }
+      pulses[j] = pulse;
+    }
+    for (uint32_t j = 0; j < pulse_count; j++)
+    {
+      Pulse& pulse = pulses[j];
+      // Note: the last segment never pushes or pulls anything.
+      for (uint32_t i = pulse.position + 1; i < C::kLength; i++)
+      {
+        _simulate_window_segment<C>(dst[i], dst[i + 1], pulse.counter);
+      }
+    }
+  }
+} // namespace snaperz
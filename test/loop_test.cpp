@@ -0,0 +1,258 @@
+// Checks the loops found with every engine, with either loop check and on
+// either thread, against the loops of the fallback engine, which simulates
+// the pulses one after the other, as well as the segments that the loops are
+// confirmed with.
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "snaperz_loop.h"
+#include "snaperz_loop_thread.h"
+
+using snaperz::Backend;
+using snaperz::Loop;
+using snaperz::LoopCheck;
+
+static int failures = 0;
+
+static constexpr Backend kBackends[] = {
+  Backend::kFallback,
+  Backend::kSse41,
+  Backend::kAvx2,
+  Backend::kAvx512,
+  Backend::kLookahead,
+  Backend::kSwar,
+};
+
+struct Outcome
+{
+  bool looped;
+  // The number of pulses until the extender finished, if it did not loop.
+  uint64_t pulses;
+  Loop loop;
+};
+
+// Simulates the extender C with the given engine, checking for loops in
+// between pulses or on a second thread.
+template<typename C>
+Outcome simulate(Backend backend, LoopCheck check, bool loop_thread = false)
+{
+  Outcome outcome = {};
+  snaperz::Extender<C> extender = snaperz::create<C>(backend);
+  outcome.looped = loop_thread
+    ? snaperz::simulate_with_loop_thread(extender, outcome.pulses, check, {}, outcome.loop)
+    : snaperz::simulate_with_loop_check(extender, outcome.pulses, check, {}, outcome.loop);
+  snaperz::destroy(extender);
+  return outcome;
+}
+
+void check_outcome(const char* name, uint32_t length, uint32_t period, const Outcome& expected,
+                   const Outcome& actual)
+{
+  const bool same = expected.looped
+    ? actual.looped && actual.loop.length == expected.loop.length &&
+      actual.loop.start == expected.loop.start
+    : !actual.looped && actual.pulses == expected.pulses;
+  if (!same)
+  {
+    std::cerr << name << ": " << length << " extender, " << period << " tick period: expected ";
+    if (expected.looped)
+    {
+      std::cerr
+        << "loop of " << expected.loop.length << " pulses after " << expected.loop.start
+        << " pulses, got ";
+    }
+    else
+    {
+      std::cerr << "done after " << expected.pulses << " pulses, got ";
+    }
+    if (actual.looped)
+    {
+      std::cerr
+        << "loop of " << actual.loop.length << " pulses after " << actual.loop.start
+        << " pulses" << std::endl;
+    }
+    else
+    {
+      std::cerr << "done after " << actual.pulses << " pulses" << std::endl;
+    }
+    failures++;
+  }
+}
+
+// Compares every supported engine using the given check with the fallback
+// engine using Brent's algorithm. Since the engines that keep several pulses
+// in flight fingerprint the phase of their windows, which repeats between
+// samples, they also notice the loop within a sample of the fallback engine
+// using the same check.
+template<uint32_t kLength, uint32_t kPeriod>
+void test_loops(LoopCheck check)
+{
+  typedef Config<kLength, kPeriod> C;
+  const Outcome expected = simulate<C>(Backend::kFallback, LoopCheck::kBrent);
+  const Outcome reference = simulate<C>(Backend::kFallback, check);
+  for (Backend backend : kBackends)
+  {
+    if (!snaperz::supported<C>(backend))
+    {
+      continue;
+    }
+    const std::string name = std::string(snaperz::backend_name(backend)) +
+      (check == LoopCheck::kDistinguishedPoints ? " (table)" : "");
+    const Outcome actual = simulate<C>(backend, check);
+    check_outcome(name.c_str(), kLength, kPeriod, expected, actual);
+    if (expected.looped && actual.looped &&
+        actual.loop.pulses > reference.loop.pulses + LOOP_CHECK_INTERVAL)
+    {
+      std::cerr
+        << name << ": " << kLength << " extender, " << kPeriod << " tick period: expected loop by "
+        << reference.loop.pulses + LOOP_CHECK_INTERVAL << " pulses, got " << actual.loop.pulses
+        << " pulses" << std::endl;
+      failures++;
+    }
+  }
+}
+
+// Checks that the second thread, see snaperz_loop_thread.h, notices the same
+// loops after the same number of pulses as the check in between pulses.
+template<uint32_t kLength, uint32_t kPeriod>
+void test_loop_thread(LoopCheck check)
+{
+  typedef Config<kLength, kPeriod> C;
+  for (Backend backend : kBackends)
+  {
+    if (!snaperz::supported<C>(backend))
+    {
+      continue;
+    }
+    const Outcome expected = simulate<C>(backend, check);
+    const Outcome actual = simulate<C>(backend, check, true);
+    const std::string name = std::string(snaperz::backend_name(backend)) + " (loop thread)";
+    check_outcome(name.c_str(), kLength, kPeriod, expected, actual);
+    if (expected.looped && actual.looped && actual.loop.pulses != expected.loop.pulses)
+    {
+      std::cerr
+        << name << ": " << kLength << " extender, " << kPeriod << " tick period: expected loop at "
+        << expected.loop.pulses << " pulses, got " << actual.loop.pulses << " pulses"
+        << std::endl;
+      failures++;
+    }
+  }
+}
+
+// Checks that every engine has the same segments as the fallback engine after
+// every pulse, regardless of the pulses that it keeps in flight.
+template<uint32_t kLength, uint32_t kPeriod>
+void test_segments(uint64_t pulses)
+{
+  typedef Config<kLength, kPeriod> C;
+  std::vector<typename C::len_t> expected(kLength + 1);
+  std::vector<typename C::len_t> actual(kLength + 1);
+  for (Backend backend : kBackends)
+  {
+    if (!snaperz::supported<C>(backend))
+    {
+      continue;
+    }
+    snaperz::Extender<C> reference = snaperz::create<C>(Backend::kFallback);
+    snaperz::Extender<C> extender = snaperz::create<C>(backend);
+    for (uint64_t i = 0; i < pulses && !snaperz::finished(reference); i++)
+    {
+      snaperz::simulate_pulse(reference);
+      snaperz::simulate_pulse(extender);
+      snaperz::read_segments(reference, expected.data());
+      snaperz::read_segments(extender, actual.data());
+      if (actual != expected)
+      {
+        std::cerr
+          << snaperz::backend_name(backend) << ": " << kLength << " extender, " << kPeriod
+          << " tick period: different segments after " << i + 1 << " pulses" << std::endl;
+        failures++;
+        break;
+      }
+    }
+    snaperz::destroy(reference);
+    snaperz::destroy(extender);
+  }
+}
+
+// Checks that an AVX2 extender created from the segments of another one,
+// see snaperz::avx2::create(), continues like the fallback engine does from
+// the same segments, even though it starts with empty windows.
+template<uint32_t kLength, uint32_t kPeriod>
+void test_avx2_round_trip(uint64_t pulses)
+{
+#if SNAPERZ_X86
+  typedef Config<kLength, kPeriod> C;
+  if (!snaperz::supported<C>(Backend::kAvx2))
+  {
+    return;
+  }
+  std::vector<typename C::len_t> expected(kLength + 1);
+  std::vector<typename C::len_t> actual(kLength + 1);
+  snaperz::Extender<C> reference = snaperz::create<C>(Backend::kFallback);
+  snaperz::Extender<C> extender = snaperz::create<C>(Backend::kAvx2);
+  for (uint64_t i = 0; i < pulses; i++)
+  {
+    snaperz::simulate_pulse(reference);
+    snaperz::simulate_pulse(extender);
+  }
+  snaperz::read_segments(extender, actual.data());
+  snaperz::avx2::Extender<C> restored = snaperz::avx2::create<C>(actual.data());
+  for (uint64_t i = 0; i < pulses && !snaperz::finished(reference); i++)
+  {
+    snaperz::simulate_pulse(reference);
+    snaperz::avx2::simulate_pulse(restored);
+    snaperz::read_segments(reference, expected.data());
+    snaperz::avx2::read_segments(restored, actual.data());
+    if (actual != expected)
+    {
+      std::cerr
+        << "avx2 (restored): " << kLength << " extender, " << kPeriod
+        << " tick period: different segments after " << pulses + i + 1 << " pulses" << std::endl;
+      failures++;
+      break;
+    }
+  }
+  snaperz::avx2::destroy(restored);
+  snaperz::destroy(reference);
+  snaperz::destroy(extender);
+#endif // SNAPERZ_X86
+}
+
+int main()
+{
+  test_segments<5, 12>(500);
+  test_segments<44, 28>(3000);
+  test_segments<65, 12>(3000);
+  test_segments<300, 24>(1000);
+  test_avx2_round_trip<44, 28>(1000);
+  test_avx2_round_trip<300, 24>(500);
+
+  // The fallback engine itself, whose loop at 44/28 the windowed engines
+  // used to get wrong.
+  const Outcome known = simulate<Config<44, 28>>(Backend::kFallback, LoopCheck::kBrent);
+  check_outcome("fallback", 44, 28, { true, 0, { 0, 760, 1460 } }, known);
+
+  for (LoopCheck check : { LoopCheck::kBrent, LoopCheck::kDistinguishedPoints })
+  {
+    test_loops<20, 12>(check);
+    test_loops<31, 16>(check);
+    test_loops<44, 28>(check);
+    test_loops<50, 40>(check);
+    test_loops<60, 36>(check);
+    test_loops<100, 64>(check);
+
+    test_loop_thread<20, 12>(check);
+    test_loop_thread<44, 28>(check);
+    test_loop_thread<50, 40>(check);
+  }
+  if (failures != 0)
+  {
+    std::cerr << failures << " checks failed." << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,126 @@
+// Checks the sweep engines against the fallback implementation of the sweep,
+// which follows the fallback implementation of the extender.
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "snaperz_sweep.h"
+
+typedef std::map<std::pair<uint32_t, uint32_t>, snaperz::SweepResult> SweepResults;
+
+static int failures = 0;
+
+// Simulates the given jobs with the given engine, which takes the same
+// arguments as the sweep() functions of the engines.
+template<typename F>
+SweepResults run_sweep(const std::vector<snaperz::SweepJob>& jobs, uint32_t max_length, F&& sweep)
+{
+  SweepResults results;
+  size_t next = 0;
+  sweep(max_length, [&](snaperz::SweepJob& job)
+  {
+    if (next == jobs.size())
+    {
+      return false;
+    }
+    job = jobs[next++];
+    return true;
+  }, [&](const snaperz::SweepResult& result)
+  {
+    results[{ result.job.length, result.job.period }] = result;
+  });
+  return results;
+}
+
+void check_results(const char* name, const SweepResults& expected, const SweepResults& actual)
+{
+  for (const auto& [key, result] : expected)
+  {
+    const auto it = actual.find(key);
+    if (it == actual.end() || it->second.loop != result.loop || it->second.pulses != result.pulses)
+    {
+      std::cerr
+        << name << ": " << key.first << " extender, " << key.second << " tick period: expected "
+        << (result.loop ? "loop at " : "done after ") << result.pulses << " pulses" << std::endl;
+      failures++;
+    }
+  }
+}
+
+// The lengths that fit in the bits of the bit-sliced engine, up to 20, which
+// all finish or loop quickly, with periods whose push limits do not fit.
+template<uint32_t kBits>
+void test_bitslice()
+{
+  const uint32_t max_length = std::min((UINT32_C(1) << kBits) - 2, UINT32_C(20));
+  std::vector<snaperz::SweepJob> jobs;
+  for (uint32_t length = 1; length <= max_length; length++)
+  {
+    for (uint32_t period = kMinValidPeriod; period <= 64; period++)
+    {
+      jobs.push_back({ length, period });
+    }
+  }
+  const SweepResults expected = run_sweep(jobs, max_length, snaperz::sweep_fallback::sweep);
+  const SweepResults actual = run_sweep(jobs, max_length, snaperz::sweep_bitslice::sweep<kBits>);
+  check_results("bitslice", expected, actual);
+}
+
+#if SNAPERZ_X86
+// A mix of lengths with the periods up to 19, some of which loop, first in
+// bytes and then in words, together with extenders that are too long for
+// bytes, which loop quickly. The engine simulates the lanes of several
+// registers of a row side by side, see snaperz_sweep_avx2.h.
+void test_avx2()
+{
+  if (!__builtin_cpu_supports("avx2"))
+  {
+    return;
+  }
+  std::vector<snaperz::SweepJob> jobs;
+  for (uint32_t length = 1; length <= 34; length++)
+  {
+    for (uint32_t period = kMinValidPeriod; period <= 19; period++)
+    {
+      jobs.push_back({ length, period });
+    }
+  }
+  // Several times as many jobs as a row has lanes, so that the interleaved
+  // registers of a row are refilled many times.
+  assert(jobs.size() > 4 * snaperz::sweep_avx2::kRowLength<uint8_t>);
+  SweepResults expected = run_sweep(jobs, 34, snaperz::sweep_fallback::sweep);
+  check_results("avx2 (uint8_t)", expected,
+                run_sweep(jobs, 34, snaperz::sweep_avx2::sweep<uint8_t>));
+
+  // The jobs fill the lanes in order, so the long extenders go into the
+  // first and the second register of a row, see snaperz_sweep_avx2.h, while
+  // the short ones keep refilling the other lanes of both.
+  const std::vector<snaperz::SweepJob> long_jobs = { { 256, 44 }, { 257, 48 } };
+  expected.merge(run_sweep(long_jobs, 257, snaperz::sweep_fallback::sweep));
+  jobs.insert(jobs.begin() + 1, long_jobs[0]);
+  jobs.insert(jobs.begin() + snaperz::sweep_avx2::kLaneCount<uint16_t> + 1, long_jobs[1]);
+  check_results("avx2 (uint16_t)", expected,
+                run_sweep(jobs, 257, snaperz::sweep_avx2::sweep<uint16_t>));
+}
+#endif // SNAPERZ_X86
+
+int main()
+{
+  test_bitslice<3>();
+  test_bitslice<4>();
+  test_bitslice<6>();
+#if SNAPERZ_X86
+  test_avx2();
+#endif // SNAPERZ_X86
+  if (failures != 0)
+  {
+    std::cerr << failures << " checks failed." << std::endl;
+    return EXIT_FAILURE;
+  }
+  return EXIT_SUCCESS;
+}